@@ -12,6 +12,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <time.h>
 
 /**
  * @brief The maximum line length.
@@ -32,37 +37,275 @@
  
 
 
+// a date and time packed into one integer at minute resolution:
+// year << 20 | month << 16 | day << 11 | hour << 6 | minute
+// a later time always compares greater, and each part comes back out with a shift and a mask
+typedef long long Timestamp;
+
+#define TIMESTAMP_YEAR(t) ((int)((t) >> 20))
+#define TIMESTAMP_MONTH(t) ((int)(((t) >> 16) & 15))
+#define TIMESTAMP_DAY(t) ((int)(((t) >> 11) & 31))
+#define TIMESTAMP_HOUR(t) ((int)(((t) >> 6) & 31))
+#define TIMESTAMP_MINUTE(t) ((int)((t) & 63))
+// the calendar day of a timestamp, used to group events by day
+#define TIMESTAMP_DATE(t) ((t) >> 11)
+// later than any date and time an .ics file can hold
+#define TIMESTAMP_LATEST ((Timestamp)10000 << 20)
+
+
 char* startDateArg = NULL;
 char* endDateArg = NULL;
-char* fileNameArg = NULL;
-char startDate[11];
-char endDate[11];
+char** fileNameArgs = NULL;
+int numFileArgs = 0;
+int buildIndexArg = 0;
+int threadsArg = 1;
+int followArg = 0;
+char* statsArg = NULL;
+Timestamp rangeStart = 0;
+Timestamp rangeEnd = 0;
 int new_line = 0;
 
 
+// packs the components of a date and time into a Timestamp
+Timestamp makeTimestamp(int year, int month, int day, int hour, int minute) {
+    return ((Timestamp)year << 20) | ((Timestamp)month << 16) | ((Timestamp)day << 11) | ((Timestamp)hour << 6) | minute;
+}
+
+
+// number of days in a month of a year
+int daysInMonth(int year, int month) {
+    static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    if (month == 2 && ((year % 4 == 0 && year % 100 != 0) || year % 400 == 0)) {
+        return 29;
+    }
+    return days[month - 1];
+}
+
+
+// reads n digits starting at s; returns -1 if any of them is not a digit
+int readDigits(const char* s, int n) {
+    int value = 0;
+    for (int i = 0; i < n; i++) {
+        if (s[i] < '0' || s[i] > '9') {
+            return -1;
+        }
+        value = value * 10 + (s[i] - '0');
+    }
+    return value;
+}
+
+
 // Function to parse the date and time from a given string
-// takes a string dateTime as input and extracts individual components of the date and time from it
-void parseDateTime(const char* dateTime, int* year, int* month, int* day, int* hour, int* minute) {
-    sscanf(dateTime, "%4d%2d%2dT%2d%2d", year, month, day, hour, minute);
+// decodes an iCalendar DATE-TIME (YYYYMMDDTHHMMSS, optionally followed by Z) or DATE (YYYYMMDD) value once,
+// when the event is read; seconds are dropped. returns 0 if the value is malformed
+int parseTimestamp(const char* value, size_t len, Timestamp* timestamp) {
+    int hour = 0, minute = 0;
+
+    if (len < 8) {
+        return 0;
+    }
+    int year = readDigits(value, 4);
+    int month = readDigits(value + 4, 2);
+    int day = readDigits(value + 6, 2);
+    if (len >= 13 && value[8] == 'T') {
+        hour = readDigits(value + 9, 2);
+        minute = readDigits(value + 11, 2);
+    }
+    if (year < 0 || month < 1 || month > 12 || day < 1 || day > 31 || hour < 0 || hour > 23 || minute < 0 || minute > 59) {
+        return 0;
+    }
+    *timestamp = makeTimestamp(year, month, day, hour, minute);
+    return 1;
+}
+
+
+
+// the stages of a run that --stats times
+enum { STAGE_INDEX, STAGE_SCAN, STAGE_SORT, STAGE_OUTPUT, NUM_STAGES };
+const char* const STAGE_NAMES[NUM_STAGES] = { "index", "scan", "sort", "output" };
+
+// the counters --stats reports
+enum {
+    COUNT_BYTES_READ, COUNT_LINES_READ, COUNT_EVENTS_PARSED, COUNT_EVENTS_SKIPPED, COUNT_EVENTS_REREAD,
+    COUNT_EVENTS_KEPT, COUNT_ALLOCATIONS, COUNT_BYTES_ALLOCATED, COUNT_SORT_PASSES, COUNT_BYTES_WRITTEN, NUM_COUNTERS
+};
+const char* const COUNTER_NAMES[NUM_COUNTERS] = {
+    "bytes_read", "lines_read", "events_parsed", "events_skipped", "events_reread",
+    "events_kept", "allocations", "bytes_allocated", "sort_passes", "bytes_written"
+};
+
+// the stage times and counters of one thread. every thread counts into its own copy with plain increments, and the
+// copies of the scan threads are added to the main thread's when they are joined, so the scan time is summed over threads
+typedef struct {
+    double wall[NUM_STAGES];
+    double cpu[NUM_STAGES];
+    unsigned long long counters[NUM_COUNTERS];
+} Stats;
+
+_Thread_local Stats threadStats;
+
+#define STATS_COUNT(counter, n) (threadStats.counters[counter] += (n))
+#define STATS_ALLOCATION(n) (STATS_COUNT(COUNT_ALLOCATIONS, 1), STATS_COUNT(COUNT_BYTES_ALLOCATED, (n)))
+
+// a point in time on the wall clock and on the CPU clock of the calling thread, in seconds
+typedef struct {
+    double wall;
+    double cpu;
+} StatsMark;
+
+
+// reads both clocks
+StatsMark statsNow() {
+    struct timespec wall, cpu;
+    StatsMark mark;
+
+    clock_gettime(CLOCK_MONOTONIC, &wall);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    mark.wall = wall.tv_sec + wall.tv_nsec / 1e9;
+    mark.cpu = cpu.tv_sec + cpu.tv_nsec / 1e9;
+    return mark;
+}
+
+
+// charges the time since mark to a stage and moves mark to now; stages are only timed at their boundaries
+void chargeStage(int stage, StatsMark* mark) {
+    StatsMark now = statsNow();
+    threadStats.wall[stage] += now.wall - mark->wall;
+    threadStats.cpu[stage] += now.cpu - mark->cpu;
+    *mark = now;
+}
+
+
+// adds the stage times and counters of another thread to the calling thread's
+void addStats(const Stats* other) {
+    for (int s = 0; s < NUM_STAGES; s++) {
+        threadStats.wall[s] += other->wall[s];
+        threadStats.cpu[s] += other->cpu[s];
+    }
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        threadStats.counters[c] += other->counters[c];
+    }
+}
+
+
+// writes the stage times and counters of the run as one line of JSON, to stderr for "-" or else to the named file
+void reportStats(const char* destination, StatsMark start) {
+    struct timespec cpu;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+    double wall = statsNow().wall - start.wall;
+
+    FILE* file = strcmp(destination, "-") == 0 ? stderr : fopen(destination, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s for writing.\n", destination);
+        return;
+    }
+    fprintf(file, "{\"tool\":\"event_manager\",\"threads\":%d,\"wall_s\":%.6f,\"cpu_s\":%.6f,\"stages\":{",
+            threadsArg, wall, cpu.tv_sec + cpu.tv_nsec / 1e9);
+    for (int s = 0; s < NUM_STAGES; s++) {
+        fprintf(file, "%s\"%s\":{\"wall_s\":%.6f,\"cpu_s\":%.6f}", s > 0 ? "," : "", STAGE_NAMES[s], threadStats.wall[s], threadStats.cpu[s]);
+    }
+    fprintf(file, "},\"counters\":{");
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        fprintf(file, "%s\"%s\":%llu", c > 0 ? "," : "", COUNTER_NAMES[c], threadStats.counters[c]);
+    }
+    fprintf(file, "}}\n");
+    if (file != stderr) {
+        fclose(file);
+    }
+}
+
+
+
+// size of the output buffer: headers and event lines are rendered into it and written to stdout in large blocks
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+char outputBuffer[OUTPUT_BUFFER_SIZE];
+size_t outputLength = 0;
+
+// the month names for the date headers, with their lengths
+const char* const MONTH_NAMES[12] = {"January", "February", "March", "April", "May", "June", "July", "August", "September", "October", "November", "December"};
+const int MONTH_NAME_LENGTHS[12] = { 7, 8, 5, 5, 3, 4, 4, 6, 9, 7, 8, 8 };
+
+// the underline of a date header is as long as the month name plus " DD, YYYY"
+#define UNDERLINE_EXTRA 9
+const char UNDERLINE[] = "------------------";
+
+// every hour of the day on the 12-hour clock as "HH:MM AM"; the minutes are filled in when a time is written
+const char CLOCK_TIMES[24][9] = {
+    "12:00 AM", " 1:00 AM", " 2:00 AM", " 3:00 AM", " 4:00 AM", " 5:00 AM",
+    " 6:00 AM", " 7:00 AM", " 8:00 AM", " 9:00 AM", "10:00 AM", "11:00 AM",
+    "12:00 PM", " 1:00 PM", " 2:00 PM", " 3:00 PM", " 4:00 PM", " 5:00 PM",
+    " 6:00 PM", " 7:00 PM", " 8:00 PM", " 9:00 PM", "10:00 PM", "11:00 PM"
+};
+
+
+// writes the buffered output to stdout
+void flushOutput() {
+    if (outputLength > 0) {
+        STATS_COUNT(COUNT_BYTES_WRITTEN, fwrite(outputBuffer, 1, outputLength, stdout));
+        outputLength = 0;
+    }
+}
+
+
+// makes room for len bytes at the end of the output buffer, flushing it if needed; len must fit in the buffer
+char* reserveOutput(size_t len) {
+    if (outputLength + len > OUTPUT_BUFFER_SIZE) {
+        flushOutput();
+    }
+    return outputBuffer + outputLength;
 }
 
 
+// appends bytes of any length to the output
+void writeOutput(const char* bytes, size_t len) {
+    if (outputLength + len > OUTPUT_BUFFER_SIZE) {
+        flushOutput();
+        if (len > OUTPUT_BUFFER_SIZE) {
+            STATS_COUNT(COUNT_BYTES_WRITTEN, fwrite(bytes, 1, len, stdout));
+            return;
+        }
+    }
+    memcpy(outputBuffer + outputLength, bytes, len);
+    outputLength += len;
+}
+
 
 // Function to print a formatted date header for a specific date
 //takes three arguments: month, day, and year, representing the components of the date.
+//renders "Month DD, YYYY" and its underline into the output buffer
 void printDateHeader(int month, int day, int year) {
-     
-    char* months[] = {"January", "February", "March", "April", "May", "June", "July", "August", "September", "October", "November", "December"};
+    int nameLength = MONTH_NAME_LENGTHS[month - 1];
+    char digits[12];
+    int numDigits = 0;
+    unsigned int value = (unsigned int)year;
+
+    do {
+        digits[numDigits++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
 
+    // the longest header: a blank line, "September 30, " and ten year digits, then the underline
+    char* p = reserveOutput(1 + 9 + 4 + 10 + 1 + 18 + 1 + 8);
+    char* start = p;
      if (new_line != 0){
-        printf("\n");
+        *p++ = '\n';
      }
-    
-    printf("%s %02d, %d\n", months[month - 1], day, year);
-    for (int i = 0; i < strlen(months[month - 1]) + 3 + 2 + 4; i++) {
-        printf("-");
+    memcpy(p, MONTH_NAMES[month - 1], nameLength);
+    p += nameLength;
+    *p++ = ' ';
+    *p++ = (char)('0' + day / 10);
+    *p++ = (char)('0' + day % 10);
+    *p++ = ',';
+    *p++ = ' ';
+    while (numDigits > 0) {
+        *p++ = digits[--numDigits];
     }
-    printf("\n");
+    *p++ = '\n';
+    memcpy(p, UNDERLINE, nameLength + UNDERLINE_EXTRA);
+    p += nameLength + UNDERLINE_EXTRA;
+    *p++ = '\n';
+    outputLength += p - start;
     new_line = 1; 
 }
 
@@ -70,37 +313,48 @@ void printDateHeader(int month, int day, int year) {
 
 // Function to print the formatted date and time range along with summary and location
 //takes six arguments: startHour, startMinute, endHour, endMinute, summary, and location.
+//renders "HH:MM AM to HH:MM PM: summary {{location}}" into the output buffer
 void printDateTimeRange(int startHour, int startMinute, int endHour, int endMinute, const char* summary, const char* location) {
-    printf("%2d:%02d %s to %2d:%02d %s: %s {{%s}}\n",
-        (startHour % 12 == 0) ? 12 : startHour % 12, startMinute, startHour < 12 ? "AM" : "PM",
-        (endHour % 12 == 0) ? 12 : endHour % 12, endMinute, endHour < 12 ? "AM" : "PM",
-        summary, location);
+    char* p = reserveOutput(22);
+    memcpy(p, CLOCK_TIMES[startHour], 8);
+    p[3] = (char)('0' + startMinute / 10);
+    p[4] = (char)('0' + startMinute % 10);
+    memcpy(p + 8, " to ", 4);
+    memcpy(p + 12, CLOCK_TIMES[endHour], 8);
+    p[15] = (char)('0' + endMinute / 10);
+    p[16] = (char)('0' + endMinute % 10);
+    p[20] = ':';
+    p[21] = ' ';
+    outputLength += 22;
+    writeOutput(summary, strlen(summary));
+    writeOutput(" {{", 3);
+    writeOutput(location, strlen(location));
+    writeOutput("}}\n", 3);
 }
 
 
 
-// is the main function that combines the other functions (parseDateTime, printDateHeader, and printDateTimeRange) to print the formatted representation of a date and time range, along with the provided summary and location.
-void printFormattedDateTime(const char* dtstart, const char* dtend, const char* summary, const char* location) {
+// is the main function that combines the other functions (printDateHeader and printDateTimeRange) to print the formatted representation of a date and time range, along with the provided summary and location.
+void printFormattedDateTime(Timestamp start, Timestamp end, const char* summary, const char* location) {
      
-    static int prevDay = -1; // variable to store the previous day
-    int startYear, startMonth, startDay, startHour, startMinute;
-    int endYear, endMonth, endDay, endHour, endMinute;
-
-    parseDateTime(dtstart, &startYear, &startMonth, &startDay, &startHour, &startMinute);
-    parseDateTime(dtend, &endYear, &endMonth, &endDay, &endHour, &endMinute);
+    static Timestamp prevDate = -1; // variable to store the previous day
 
-    if (startDay != prevDay) {
+    if (TIMESTAMP_DATE(start) != prevDate) {
     
-        printDateHeader(startMonth, startDay, startYear);
-        prevDay = startDay;
+        printDateHeader(TIMESTAMP_MONTH(start), TIMESTAMP_DAY(start), TIMESTAMP_YEAR(start));
+        prevDate = TIMESTAMP_DATE(start);
     }
 
-    printDateTimeRange(startHour, startMinute, endHour, endMinute, summary, location);
+    printDateTimeRange(TIMESTAMP_HOUR(start), TIMESTAMP_MINUTE(start), TIMESTAMP_HOUR(end), TIMESTAMP_MINUTE(end), summary, location);
     
 }
   
 
-// Extract the start date, end date, and file name from command-line arguments
+// Extract the start date, end date, and file names from command-line arguments
+// --index (re)builds the date index sidecar of the file before answering the query
+// --threads=N scans the file with N threads when there is no index to answer from
+// --follow keeps running and prints the events appended to the calendars as they arrive
+// --stats writes the time spent in every stage and the work counters of the run as JSON to stderr, --stats=PATH to a file
 void extractArguments(int argc, char* argv[]) {
     
     for (int i = 1; i < argc; i++) {
@@ -109,77 +363,1697 @@ void extractArguments(int argc, char* argv[]) {
         } else if (strncmp(argv[i], "--end=", 6) == 0) {
             endDateArg = argv[i] + 6;
         } else if (strncmp(argv[i], "--file=", 7) == 0) {
-            fileNameArg = argv[i] + 7;
+            // several calendars can be given as a comma-separated list, by repeating --file, or both
+            char* files = strdup(argv[i] + 7);
+            for (char* token = strtok(files, ","); token != NULL; token = strtok(NULL, ",")) {
+                fileNameArgs = realloc(fileNameArgs, (numFileArgs + 1) * sizeof(char*));
+                if (fileNameArgs == NULL) {
+                    fprintf(stderr, "Out of memory\n");
+                    exit(1);
+                }
+                fileNameArgs[numFileArgs++] = strdup(token);
+            }
+            free(files);
+        } else if (strcmp(argv[i], "--index") == 0) {
+            buildIndexArg = 1;
+        } else if (strcmp(argv[i], "--follow") == 0) {
+            followArg = 1;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            threadsArg = atoi(argv[i] + 10);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            statsArg = "-";
+        } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+            statsArg = argv[i] + 8;
+        }
+    }
+}
+
+
+// takes an input date string in the format YYYY/MM/DD, optionally followed by a time of day as THH:MM or " HH:MM",
+// and converts it to a Timestamp. without a time, the start of the day is used for --start and its last minute for --end.
+// returns 0 if the value is malformed, has anything after the date or time, or names a date or time that does not exist
+int parseDateArgument(const char* arg, int endOfDay, Timestamp* timestamp) {
+    int year, month, day, hour = endOfDay ? 23 : 0, minute = endOfDay ? 59 : 0;
+    int length = 0, timeLength = 0;
+
+    if (sscanf(arg, "%4d/%2d/%2d%n", &year, &month, &day, &length) != 3) {
+        return 0;
+    }
+    if (arg[length] == 'T' || arg[length] == ' ') {
+        if (sscanf(arg + length + 1, "%2d:%2d%n", &hour, &minute, &timeLength) != 2) {
+            return 0;
+        }
+        length += 1 + timeLength;
+    }
+    if (arg[length] != '\0' || year < 0 || month < 1 || month > 12 || day < 1 || day > daysInMonth(year, month) ||
+        hour < 0 || hour > 23 || minute < 0 || minute > 59) {
+        return 0;
+    }
+    *timestamp = makeTimestamp(year, month, day, hour, minute);
+    return 1;
+}
+
+
+// converts --start and --end into the Timestamp range events must fall in; a missing bound leaves that side open
+int formatDateToInt() {
+    rangeStart = 0;
+    rangeEnd = makeTimestamp(9999, 12, 31, 23, 59);
+    if (startDateArg != NULL && !parseDateArgument(startDateArg, 0, &rangeStart)) {
+        fprintf(stderr, "Invalid --start date %s, expected YYYY/MM/DD.\n", startDateArg);
+        return 0;
+    }
+    if (endDateArg != NULL && !parseDateArgument(endDateArg, 1, &rangeEnd)) {
+        fprintf(stderr, "Invalid --end date %s, expected YYYY/MM/DD.\n", endDateArg);
+        return 0;
+    }
+    return 1;
+}
+
+
+// size of the block read from the input file at a time
+#define READ_BUFFER_SIZE (1 << 20)
+
+
+// a growable text buffer, reused from line to line and event to event so memory only grows with the
+// longest line or property seen, never with the size of the file
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} Text;
+
+
+// streams an .ics file through a large read buffer and hands out logical lines:
+// RFC 5545 folded lines (a CRLF followed by a space or tab) are joined back together
+typedef struct {
+    FILE* file;
+    char* buffer;
+    size_t size;
+    size_t pos;
+    size_t end;
+    long long bufferOffset; // file offset of buffer[0]
+    long long lineOffset;   // file offset of the line last read
+    Text line;
+} LineReader;
+
+
+// appends len bytes to a text buffer, growing it when needed
+void appendText(Text* text, const char* bytes, size_t len) {
+    if (text->len + len + 1 > text->cap) {
+        size_t cap = text->cap > 0 ? text->cap : 256;
+        while (text->len + len + 1 > cap) {
+            cap *= 2;
+        }
+        char* data = realloc(text->data, cap);
+        STATS_ALLOCATION(cap);
+        if (data == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        text->data = data;
+        text->cap = cap;
+    }
+    memcpy(text->data + text->len, bytes, len);
+    text->len += len;
+    text->data[text->len] = '\0';
+}
+
+
+// replaces the contents of a text buffer
+void setText(Text* text, const char* bytes, size_t len) {
+    text->len = 0;
+    appendText(text, bytes, len);
+}
+
+
+// sets up a reader over an open file, reading it size bytes at a time
+void openReader(LineReader* reader, FILE* file, size_t size) {
+    reader->file = file;
+    reader->buffer = malloc(size);
+    STATS_ALLOCATION(size);
+    if (reader->buffer == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    reader->size = size;
+    reader->pos = reader->end = 0;
+    reader->bufferOffset = reader->lineOffset = 0;
+    reader->line.data = NULL;
+    reader->line.len = reader->line.cap = 0;
+}
+
+
+// releases the buffers of a reader; the file itself stays open
+void closeReader(LineReader* reader) {
+    free(reader->buffer);
+    free(reader->line.data);
+}
+
+
+// moves a reader to a byte offset in its file, dropping whatever was buffered
+void seekReader(LineReader* reader, long long offset) {
+    fseek(reader->file, (long)offset, SEEK_SET);
+    reader->pos = reader->end = 0;
+    reader->bufferOffset = offset;
+}
+
+
+// moves a reader to a byte offset of a file that is not changing. an offset among the buffered bytes, or just past
+// them, is reached without a seek, so events lying next to each other are served by the same read
+void advanceReader(LineReader* reader, long long offset) {
+    if (offset >= reader->bufferOffset && offset <= reader->bufferOffset + (long long)reader->end) {
+        reader->pos = (size_t)(offset - reader->bufferOffset);
+    } else {
+        seekReader(reader, offset);
+    }
+}
+
+
+// refills the read buffer once everything in it has been consumed; returns 0 at the end of the file
+int fillBuffer(LineReader* reader) {
+    if (reader->pos < reader->end) {
+        return 1;
+    }
+    reader->bufferOffset += (long long)reader->end;
+    reader->pos = 0;
+    reader->end = fread(reader->buffer, 1, reader->size, reader->file);
+    STATS_COUNT(COUNT_BYTES_READ, reader->end);
+    return reader->end > 0;
+}
+
+
+// appends the rest of the current physical line to the reader's line, consuming its line break
+// returns 0 if the file was already at its end
+int readPhysicalLine(LineReader* reader) {
+    int readAny = 0;
+
+    while (fillBuffer(reader)) {
+        char* start = reader->buffer + reader->pos;
+        char* newline = memchr(start, '\n', reader->end - reader->pos);
+        size_t len = newline != NULL ? (size_t)(newline - start) : reader->end - reader->pos;
+
+        appendText(&reader->line, start, len);
+        reader->pos += len;
+        readAny = 1;
+        if (newline != NULL) {
+            reader->pos++;
+            break;
+        }
+    }
+    if (reader->line.len > 0 && reader->line.data[reader->line.len - 1] == '\r') {
+        reader->line.data[--reader->line.len] = '\0';
+    }
+    return readAny;
+}
+
+
+// reads the next logical line into reader->line, unfolding continuation lines
+// returns 0 at the end of the file
+int readLogicalLine(LineReader* reader) {
+    reader->line.len = 0;
+    reader->lineOffset = reader->bufferOffset + (long long)reader->pos;
+    if (!readPhysicalLine(reader)) {
+        return 0;
+    }
+    STATS_COUNT(COUNT_LINES_READ, 1);
+    // a line that starts with a space or a tab continues the previous one
+    while (fillBuffer(reader) && (reader->buffer[reader->pos] == ' ' || reader->buffer[reader->pos] == '\t')) {
+        reader->pos++;
+        readPhysicalLine(reader);
+    }
+    return 1;
+}
+
+
+// splits a content line into its property name and value, skipping any parameters
+// (e.g. "DTSTART;TZID=America/Vancouver:20210214T180000" gives "DTSTART" and "20210214T180000")
+// returns 0 if the line has no value
+int splitProperty(const Text* line, size_t* nameLen, const char** value, size_t* valueLen) {
+    const char* colon = memchr(line->data, ':', line->len);
+    if (colon == NULL) {
+        return 0;
+    }
+    size_t len = 0;
+    while (line->data + len < colon && line->data[len] != ';') {
+        len++;
+    }
+    *nameLen = len;
+    *value = colon + 1;
+    *valueLen = line->len - (size_t)(colon + 1 - line->data);
+    return 1;
+}
+
+
+// tells whether a property name is the given one
+int isProperty(const Text* line, size_t nameLen, const char* name) {
+    return strlen(name) == nameLen && memcmp(line->data, name, nameLen) == 0;
+}
+
+
+// an event that passed the date filter, kept until the whole file has been read
+// summary and location are offsets of NUL-terminated strings in the store's string pool
+// start must stay the first member, radixSortByStart relies on it
+typedef struct {
+    Timestamp start;
+    Timestamp end;
+    size_t summary;
+    size_t location;
+} Event;
+
+
+// the filtered events of a run in one contiguous array, plus one pool holding all their strings
+typedef struct {
+    Event* events;
+    size_t count;
+    size_t cap;
+    Text strings;
+} EventStore;
+
+
+// copies an event into the store
+void addEvent(EventStore* store, Timestamp start, Timestamp end, const Text* summary, const Text* location) {
+    if (store->count == store->cap) {
+        size_t cap = store->cap > 0 ? store->cap * 2 : 1024;
+        Event* events = realloc(store->events, cap * sizeof(Event));
+        STATS_ALLOCATION(cap * sizeof(Event));
+        if (events == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        store->events = events;
+        store->cap = cap;
+    }
+    STATS_COUNT(COUNT_EVENTS_KEPT, 1);
+    Event* event = &store->events[store->count++];
+    event->start = start;
+    event->end = end;
+    event->summary = store->strings.len;
+    appendText(&store->strings, summary->data != NULL ? summary->data : "", summary->len + 1);
+    event->location = store->strings.len;
+    appendText(&store->strings, location->data != NULL ? location->data : "", location->len + 1);
+}
+
+
+// sorts records by start time with a stable LSD radix sort, one byte of the start timestamp per pass
+// every record must begin with its start Timestamp. keys are taken relative to the earliest start and passes over
+// bytes that are the same for every record are skipped, so a calendar spanning a few years needs three passes
+// over the array; records that start at the same time keep their order
+void radixSortByStart(void* records, size_t count, size_t size) {
+    if (count < 2) {
+        return;
+    }
+    char* from = records;
+    Timestamp min = *(Timestamp*)from, max = min;
+    for (size_t i = 1; i < count; i++) {
+        Timestamp start = *(Timestamp*)(from + i * size);
+        if (start < min) {
+            min = start;
+        }
+        if (start > max) {
+            max = start;
+        }
+    }
+
+    char* to = malloc(count * size);
+    STATS_ALLOCATION(count * size);
+    if (to == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (int shift = 0; shift < 64 && ((unsigned long long)(max - min) >> shift) != 0; shift += 8) {
+        size_t counts[256] = { 0 };
+        for (size_t i = 0; i < count; i++) {
+            counts[((unsigned long long)(*(Timestamp*)(from + i * size) - min) >> shift) & 255]++;
+        }
+        if (counts[((unsigned long long)(*(Timestamp*)from - min) >> shift) & 255] == count) {
+            continue;
         }
+        STATS_COUNT(COUNT_SORT_PASSES, 1);
+        size_t offset = 0;
+        for (int b = 0; b < 256; b++) {
+            size_t n = counts[b];
+            counts[b] = offset;
+            offset += n;
+        }
+        for (size_t i = 0; i < count; i++) {
+            size_t digit = ((unsigned long long)(*(Timestamp*)(from + i * size) - min) >> shift) & 255;
+            memcpy(to + counts[digit]++ * size, from + i * size, size);
+        }
+        char* swap = from;
+        from = to;
+        to = swap;
     }
+    if (from != (char*)records) {
+        memcpy(records, from, count * size);
+        to = from;
+    }
+    free(to);
+}
+
+
+// sorts the events of a store by start time
+void sortEvents(EventStore* store) {
+    radixSortByStart(store->events, store->count, sizeof(Event));
+}
+
+
+// releases the events and strings of a store
+void freeEvents(EventStore* store) {
+    free(store->events);
+    free(store->strings.data);
+    store->events = NULL;
+    store->count = store->cap = 0;
+    store->strings.data = NULL;
+    store->strings.len = store->strings.cap = 0;
+}
+
+
+// days from 1970/01/01 to a date of the proleptic Gregorian calendar
+long long daysFromCivil(int year, int month, int day) {
+    year -= month <= 2;
+    long long era = (year >= 0 ? year : year - 399) / 400;
+    long long yearOfEra = year - era * 400;
+    long long dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    long long dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+
+// the date of a day number counted from 1970/01/01, the inverse of daysFromCivil
+void civilFromDays(long long days, int* year, int* month, int* day) {
+    days += 719468;
+    long long era = (days >= 0 ? days : days - 146096) / 146097;
+    long long dayOfEra = days - era * 146097;
+    long long yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    long long dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    long long shiftedMonth = (5 * dayOfYear + 2) / 153;
+    *day = (int)(dayOfYear - (153 * shiftedMonth + 2) / 5 + 1);
+    *month = (int)(shiftedMonth < 10 ? shiftedMonth + 3 : shiftedMonth - 9);
+    *year = (int)(yearOfEra + era * 400 + (*month <= 2));
+}
+
+
+// day of the week of a day number, 0 for Monday through 6 for Sunday (1970/01/01 was a Thursday)
+int weekdayOf(long long days) {
+    return (int)(((days % 7) + 10) % 7);
+}
+
+
+// rounds a division towards minus infinity, so times before 1970 fall on the right day
+long long floorDiv(long long a, long long b) {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+
+// minutes since 1970/01/01 00:00 of a Timestamp, for arithmetic on dates
+long long timestampToMinutes(Timestamp t) {
+    return daysFromCivil(TIMESTAMP_YEAR(t), TIMESTAMP_MONTH(t), TIMESTAMP_DAY(t)) * 1440 + TIMESTAMP_HOUR(t) * 60 + TIMESTAMP_MINUTE(t);
 }
 
 
-// takes input date strings in the format YYYY/MM/DD, extracts the individual components, and formats them into strings in the format YYYYMMDD
-void formatDateToInt() {
-      
+// the Timestamp of a number of minutes since 1970/01/01 00:00
+Timestamp minutesToTimestamp(long long minutes) {
+    long long days = floorDiv(minutes, 1440);
     int year, month, day;
-    sscanf(startDateArg, "%4d/%2d/%2d", &year, &month, &day);
-    sprintf(startDate, "%04d%02d%02d", year, month, day);
+    int minuteOfDay = (int)(minutes - days * 1440);
+    civilFromDays(days, &year, &month, &day);
+    return makeTimestamp(year, month, day, minuteOfDay / 60, minuteOfDay % 60);
+}
+
+
+// the frequencies of RRULE that are expanded; any other FREQ leaves the event as a single occurrence
+enum { FREQ_NONE, FREQ_DAILY, FREQ_WEEKLY, FREQ_MONTHLY, FREQ_YEARLY };
+
+// the most BYDAY entries kept from one rule
+#define MAX_BYDAY 32
+
+
+// a decoded RRULE
+// a BYDAY entry is a weekday (0 for Monday) and an ordinal: 0 for every such weekday of the month or year,
+// n for the nth one, -n for the nth one counted from its end
+typedef struct {
+    int freq;
+    long long interval;
+    int hasCount;
+    long long count;
+    int hasUntil;
+    Timestamp until;
+    int numByDay;
+    int byDayWeekday[MAX_BYDAY];
+    int byDayOrdinal[MAX_BYDAY];
+} RecurrenceRule;
+
+
+// an EXDATE value: a DATE-TIME removes the occurrence starting then, a DATE removes every occurrence on that day
+typedef struct {
+    Timestamp at;
+    int dateOnly;
+} Exclusion;
 
-    sscanf(endDateArg, "%4d/%2d/%2d", &year, &month, &day);
-    sprintf(endDate, "%04d%02d%02d", year, month, day);
+
+// checks whether the key of a RRULE part is the given name
+int isRulePart(const char* key, size_t keyLen, const char* name) {
+    return strlen(name) == keyLen && memcmp(key, name, keyLen) == 0;
 }
 
 
-// reads an input file line by line, extracts specific information, and closes it
-// arguments: fileNameArg, startDate, endDate 
-//process each event separately
-void processFile(const char* fileNameArg, const char* startDate, const char* endDate) {
-       
-    FILE* file = fopen(fileNameArg, "r");
-    // Read the file line by line
-    char line[256];
-    char dtstart[16], dtend[16], summary[100], location[100];
+// reads an unsigned decimal number that fills a whole RRULE value; returns -1 if it is not one
+long long readNumber(const char* s, size_t len) {
+    return len > 0 && len <= 9 ? readDigits(s, (int)len) : -1;
+}
+
+
+// decodes the BYDAY list of a rule, e.g. MO,WE,FR or 1MO,-1FR
+void parseByDay(const char* value, size_t len, RecurrenceRule* rule) {
+    static const char* weekdays[] = { "MO", "TU", "WE", "TH", "FR", "SA", "SU" };
+    const char* end = value + len;
+
+    while (value < end) {
+        const char* comma = memchr(value, ',', end - value);
+        const char* itemEnd = comma != NULL ? comma : end;
+        int sign = 1, ordinal = 0;
+
+        if (value < itemEnd && (*value == '+' || *value == '-')) {
+            sign = *value == '-' ? -1 : 1;
+            value++;
+        }
+        while (value < itemEnd && *value >= '0' && *value <= '9') {
+            ordinal = ordinal * 10 + (*value++ - '0');
+        }
+        for (int weekday = 0; weekday < 7; weekday++) {
+            if (itemEnd - value == 2 && memcmp(value, weekdays[weekday], 2) == 0 && rule->numByDay < MAX_BYDAY && ordinal <= 53) {
+                rule->byDayWeekday[rule->numByDay] = weekday;
+                rule->byDayOrdinal[rule->numByDay] = sign * ordinal;
+                rule->numByDay++;
+            }
+        }
+        value = itemEnd + (comma != NULL);
+    }
+}
+
+
+// decodes an RRULE value such as FREQ=WEEKLY;INTERVAL=2;BYDAY=MO,WE;UNTIL=20211231T235959Z
+// returns 0 if its frequency is not one that is expanded or its COUNT is malformed
+int parseRule(const char* value, size_t len, RecurrenceRule* rule) {
+    const char* end = value + len;
+
+    memset(rule, 0, sizeof(RecurrenceRule));
+    rule->interval = 1;
+    while (value < end) {
+        const char* semicolon = memchr(value, ';', end - value);
+        const char* partEnd = semicolon != NULL ? semicolon : end;
+        const char* equals = memchr(value, '=', partEnd - value);
+
+        if (equals != NULL) {
+            size_t keyLen = equals - value;
+            const char* partValue = equals + 1;
+            size_t partLen = partEnd - partValue;
+
+            if (isRulePart(value, keyLen, "FREQ")) {
+                rule->freq = isRulePart(partValue, partLen, "DAILY") ? FREQ_DAILY :
+                             isRulePart(partValue, partLen, "WEEKLY") ? FREQ_WEEKLY :
+                             isRulePart(partValue, partLen, "MONTHLY") ? FREQ_MONTHLY :
+                             isRulePart(partValue, partLen, "YEARLY") ? FREQ_YEARLY : FREQ_NONE;
+            } else if (isRulePart(value, keyLen, "COUNT")) {
+                rule->hasCount = 1;
+                rule->count = readNumber(partValue, partLen);
+            } else if (isRulePart(value, keyLen, "INTERVAL")) {
+                long long interval = readNumber(partValue, partLen);
+                rule->interval = interval > 0 ? interval : 1;
+            } else if (isRulePart(value, keyLen, "UNTIL")) {
+                rule->hasUntil = parseTimestamp(partValue, partLen, &rule->until);
+                // a DATE bound includes the whole day
+                if (rule->hasUntil && partLen == 8) {
+                    rule->until = makeTimestamp(TIMESTAMP_YEAR(rule->until), TIMESTAMP_MONTH(rule->until), TIMESTAMP_DAY(rule->until), 23, 59);
+                }
+            } else if (isRulePart(value, keyLen, "BYDAY")) {
+                parseByDay(partValue, partLen, rule);
+            }
+        }
+        value = partEnd + (semicolon != NULL);
+    }
+    // a COUNT that is not a number leaves the number of occurrences unknown, so the event is not expanded
+    if (rule->hasCount && rule->count < 0) {
+        return 0;
+    }
+    return rule->freq != FREQ_NONE;
+}
+
+
+// the properties of one VEVENT, as read by readEvent
+typedef struct {
+    long long offset;   // byte offset of its BEGIN:VEVENT line in the file
+    long long next;     // byte offset just past its END:VEVENT line
+    Timestamp start;
+    Timestamp end;
+    int hasStart;
+    Text summary;
+    Text location;
+    int hasRule;
+    RecurrenceRule rule;
+    Exclusion* exclusions;
+    size_t numExclusions;
+    size_t exclusionCap;
+} ParsedEvent;
+
+
+// adds the values of an EXDATE line, a comma-separated list of dates or dates and times, to a parsed event
+void addExclusions(ParsedEvent* event, const char* value, size_t len) {
+    const char* end = value + len;
+
+    while (value < end) {
+        const char* comma = memchr(value, ',', end - value);
+        size_t itemLen = (comma != NULL ? comma : end) - value;
+        Timestamp at;
+
+        if (parseTimestamp(value, itemLen, &at)) {
+            if (event->numExclusions == event->exclusionCap) {
+                event->exclusionCap = event->exclusionCap > 0 ? event->exclusionCap * 2 : 8;
+                event->exclusions = realloc(event->exclusions, event->exclusionCap * sizeof(Exclusion));
+                STATS_ALLOCATION(event->exclusionCap * sizeof(Exclusion));
+                if (event->exclusions == NULL) {
+                    fprintf(stderr, "Out of memory\n");
+                    exit(1);
+                }
+            }
+            event->exclusions[event->numExclusions].at = at;
+            event->exclusions[event->numExclusions].dateOnly = itemLen == 8;
+            event->numExclusions++;
+        }
+        value += itemLen + (comma != NULL);
+    }
+}
+
+
+// tells whether a raw line starts with one of the properties that decide whether an event is in range:
+// END, DTSTART, DTEND or RRULE, followed by its parameters or value. the line must have at least 8 bytes
+int isDecidingProperty(const char* line) {
+    return (memcmp(line, "END", 3) == 0 && (line[3] == ':' || line[3] == ';')) ||
+           (memcmp(line, "DTSTART", 7) == 0 && (line[7] == ':' || line[7] == ';')) ||
+           (memcmp(line, "DTEND", 5) == 0 && (line[5] == ':' || line[5] == ';')) ||
+           (memcmp(line, "RRULE", 5) == 0 && (line[5] == ':' || line[5] == ';'));
+}
+
+
+// skips the lines of an event body up to the next line that can change whether the event is in range, finding
+// line breaks with memchr and copying nothing. a line that starts too close to the end of the buffer to be
+// checked is left to the line reader. returns 1 if any line was skipped
+int skipEventBody(LineReader* reader) {
+    int skipped = 0;
+    int atLineStart = 1;
+
+    while (fillBuffer(reader)) {
+        const char* start = reader->buffer + reader->pos;
+        size_t available = reader->end - reader->pos;
+        if (atLineStart && (available < 8 || isDecidingProperty(start))) {
+            break;
+        }
+        const char* newline = memchr(start, '\n', available);
+        skipped = 1;
+        if (newline == NULL) {
+            reader->pos = reader->end;
+            atLineStart = 0;
+        } else {
+            reader->pos += (size_t)(newline - start) + 1;
+            atLineStart = 1;
+        }
+    }
+    return skipped;
+}
+
+
+// reads lines until the next complete VEVENT and fills in its properties; returns 0 at the end of the file
+// filter-first: once DTSTART or DTEND puts a single event outside from..to, the rest of its body is skipped
+// without parsing or copying it. an event whose later properties bring it back into range or make it recur
+// is read again in full, so the result is the same as without skipping
+int readEvent(LineReader* reader, ParsedEvent* event, Timestamp from, Timestamp to) {
     int eventStarted = 0; // Flag to indicate if an event is being processed
+    int hasEnd = 0;
+    int skipped = 0;
+    int canSkip = 1;
+
+    // Read the file one unfolded line at a time
+    while (readLogicalLine(reader)) {
+        size_t nameLen, valueLen;
+        const char* value;
 
-    while (fgets(line, sizeof(line), file) != NULL) {
+        if (!splitProperty(&reader->line, &nameLen, &value, &valueLen)) {
+            continue;
+        }
         if (!eventStarted) {
             // Check if an event is starting
-            if (strncmp(line, "BEGIN:VEVENT", 12) == 0) {
+            if (isProperty(&reader->line, nameLen, "BEGIN") && valueLen == 6 && memcmp(value, "VEVENT", 6) == 0) {
                 eventStarted = 1;
+                event->offset = reader->lineOffset;
+                event->hasStart = 0;
+                event->hasRule = 0;
+                event->numExclusions = 0;
+                setText(&event->summary, "", 0);
+                setText(&event->location, "", 0);
             }
-        } else {
-            // Check if an event is ending
-            if (strncmp(line, "END:VEVENT", 10) == 0) {
-                // Convert dtstart and dtend and startDate and endDate to integers for comparison
-                int startInt = atoi(dtstart);
-                int endInt = atoi(dtend);
-                int integerStartDateArg = atoi(startDate);
-                int integerEndDateArg = atoi(endDate);
-
-                if ((integerStartDateArg <= startInt) && (integerEndDateArg >= endInt)) {
-                    printFormattedDateTime(dtstart, dtend, summary, location);
-                }
-            } else {
-                // Extract relevant information within the event
-                if (strncmp(line, "DTSTART:", 8) == 0) {
-                    sscanf(line + 8, "%s", dtstart);
-                } else if (strncmp(line, "DTEND:", 6) == 0) {
-                    sscanf(line + 6, "%s", dtend);
-                } else if (strncmp(line, "SUMMARY:", 8) == 0) {
-                    sscanf(line + 8, "%[^\n]", summary);
-                } else if (strncmp(line, "LOCATION:", 9) == 0) {
-                    sscanf(line + 9, "%[^\n]", location);
-                }
+        } else if (isProperty(&reader->line, nameLen, "END") && valueLen == 6 && memcmp(value, "VEVENT", 6) == 0) {
+            // an event without DTEND ends when it starts
+            if (!hasEnd) {
+                event->end = event->start;
             }
+            if (skipped && (event->hasRule || (event->hasStart && from <= event->start && to >= event->end))) {
+                STATS_COUNT(COUNT_EVENTS_REREAD, 1);
+                seekReader(reader, event->offset);
+                eventStarted = hasEnd = skipped = canSkip = 0;
+                continue;
+            }
+            event->next = reader->bufferOffset + (long long)reader->pos;
+            STATS_COUNT(COUNT_EVENTS_PARSED, 1);
+            STATS_COUNT(COUNT_EVENTS_SKIPPED, skipped);
+            return 1;
+        } else if (isProperty(&reader->line, nameLen, "DTSTART")) {
+            // Extract relevant information within the event, decoding the dates only once
+            event->hasStart = parseTimestamp(value, valueLen, &event->start);
+        } else if (isProperty(&reader->line, nameLen, "DTEND")) {
+            hasEnd = parseTimestamp(value, valueLen, &event->end);
+        } else if (isProperty(&reader->line, nameLen, "SUMMARY")) {
+            setText(&event->summary, value, valueLen);
+        } else if (isProperty(&reader->line, nameLen, "LOCATION")) {
+            setText(&event->location, value, valueLen);
+        } else if (isProperty(&reader->line, nameLen, "RRULE")) {
+            event->hasRule = parseRule(value, valueLen, &event->rule);
+        } else if (isProperty(&reader->line, nameLen, "EXDATE")) {
+            addExclusions(event, value, valueLen);
+        }
+        if (eventStarted && canSkip && !event->hasRule && ((event->hasStart && event->start < from) || (hasEnd && event->end > to))) {
+            skipped |= skipEventBody(reader);
         }
     }
-    fclose(file);
+    return 0;
 }
 
- 
 
-// main Function
-int main(int argc, char* argv[]) { 
-    extractArguments(argc, argv);
-    formatDateToInt();
-    processFile(fileNameArg, startDate, endDate);
+// releases the text buffers of a parsed event
+void freeParsedEvent(ParsedEvent* event) {
+    free(event->summary.data);
+    free(event->location.data);
+    free(event->exclusions);
+}
+
+// checks whether an EXDATE of the event removes the occurrence starting at a Timestamp
+int isExcluded(const ParsedEvent* event, Timestamp start) {
+    for (size_t i = 0; i < event->numExclusions; i++) {
+        const Exclusion* exclusion = &event->exclusions[i];
+        if (exclusion->dateOnly ? TIMESTAMP_DATE(exclusion->at) == TIMESTAMP_DATE(start) : exclusion->at == start) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+// checks whether a day matches the BYDAY list of a rule; fromStart and fromEnd count the days between it and the
+// first and last day of its month or year
+int matchesByDay(const RecurrenceRule* rule, int weekday, long long fromStart, long long fromEnd) {
+    for (int i = 0; i < rule->numByDay; i++) {
+        int ordinal = rule->byDayOrdinal[i];
+        if (rule->byDayWeekday[i] == weekday &&
+            (ordinal == 0 || (ordinal > 0 && fromStart / 7 + 1 == ordinal) || (ordinal < 0 && fromEnd / 7 + 1 == -ordinal))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+// the most candidate days in one period of a rule: every day of a leap year
+#define MAX_PERIOD_DAYS 366
+
+
+// lists, in order, the candidate days of one period of a rule: the period-th day, week, month or year, counting in
+// steps of INTERVAL from the one that holds firstDay. stores the first day of the period in periodStart and returns
+// the number of candidates
+int periodDays(const RecurrenceRule* rule, long long firstDay, long long period, long long* days, long long* periodStart) {
+    int year, month, day, count = 0;
+    civilFromDays(firstDay, &year, &month, &day);
+
+    if (rule->freq == FREQ_DAILY) {
+        long long d = firstDay + period * rule->interval;
+        *periodStart = d;
+        if (rule->numByDay == 0 || matchesByDay(rule, weekdayOf(d), 0, 0)) {
+            days[count++] = d;
+        }
+    } else if (rule->freq == FREQ_WEEKLY) {
+        // weeks start on Monday
+        long long weekStart = firstDay - weekdayOf(firstDay) + period * rule->interval * 7;
+        *periodStart = weekStart;
+        for (int weekday = 0; weekday < 7; weekday++) {
+            if (rule->numByDay == 0 ? weekday == weekdayOf(firstDay) : matchesByDay(rule, weekday, 0, 0)) {
+                days[count++] = weekStart + weekday;
+            }
+        }
+    } else if (rule->freq == FREQ_MONTHLY) {
+        long long monthIndex = (long long)year * 12 + (month - 1) + period * rule->interval;
+        int periodYear = (int)(monthIndex / 12), periodMonth = (int)(monthIndex % 12) + 1;
+        int length = daysInMonth(periodYear, periodMonth);
+        long long monthStart = daysFromCivil(periodYear, periodMonth, 1);
+        *periodStart = monthStart;
+        for (int i = 0; i < length; i++) {
+            // without BYDAY the day of the month of DTSTART is used, and months too short for it are skipped
+            if (rule->numByDay == 0 ? i + 1 == day : matchesByDay(rule, weekdayOf(monthStart + i), i, length - 1 - i)) {
+                days[count++] = monthStart + i;
+            }
+        }
+    } else {
+        int periodYear = (int)(year + period * rule->interval);
+        long long yearStart = daysFromCivil(periodYear, 1, 1);
+        long long length = daysFromCivil(periodYear + 1, 1, 1) - yearStart;
+        *periodStart = yearStart;
+        if (rule->numByDay == 0) {
+            if (day <= daysInMonth(periodYear, month)) {
+                days[count++] = daysFromCivil(periodYear, month, day);
+            }
+        } else {
+            for (long long i = 0; i < length; i++) {
+                if (matchesByDay(rule, weekdayOf(yearStart + i), i, length - 1 - i)) {
+                    days[count++] = yearStart + i;
+                }
+            }
+        }
+    }
+    return count;
+}
+
+
+// adds the occurrences of a recurring event that start and end inside the range, minus those removed by EXDATE
+// occurrences are generated one period at a time. a rule without COUNT starts at the period that holds the start of
+// the range, so a standing meeting costs as much as its occurrences in the range, however old it is; with COUNT the
+// earlier occurrences have to be counted, which is bounded by COUNT itself. generation stops at the end of the range,
+// at UNTIL, or after COUNT occurrences, whichever comes first
+void expandEvent(const ParsedEvent* event, Timestamp from, Timestamp to, EventStore* store) {
+    const RecurrenceRule* rule = &event->rule;
+    long long first = timestampToMinutes(event->start);
+    long long duration = timestampToMinutes(event->end) - first;
+    long long low = timestampToMinutes(from);
+    // the latest start whose occurrence still ends inside the range
+    long long high = timestampToMinutes(to) - duration;
+
+    if (rule->hasUntil && timestampToMinutes(rule->until) < high) {
+        high = timestampToMinutes(rule->until);
+    }
+    if (high < first || high < low) {
+        return;
+    }
+    long long firstDay = floorDiv(first, 1440);
+    long long timeOfDay = first - firstDay * 1440;
+    long long lastDay = floorDiv(high, 1440);
+    long long period = 0;
+
+    if (!rule->hasCount && low > first) {
+        long long lowDay = floorDiv(low, 1440);
+        int year, month, day, lowYear, lowMonth, lowDate;
+        civilFromDays(firstDay, &year, &month, &day);
+        civilFromDays(lowDay, &lowYear, &lowMonth, &lowDate);
+        if (rule->freq == FREQ_DAILY) {
+            period = (lowDay - firstDay) / rule->interval;
+        } else if (rule->freq == FREQ_WEEKLY) {
+            period = (lowDay - (firstDay - weekdayOf(firstDay))) / (rule->interval * 7);
+        } else if (rule->freq == FREQ_MONTHLY) {
+            period = (((long long)lowYear * 12 + lowMonth) - ((long long)year * 12 + month)) / rule->interval;
+        } else {
+            period = (lowYear - year) / rule->interval;
+        }
+    }
+
+    long long days[MAX_PERIOD_DAYS];
+    long long seen = 0;
+    for (;; period++) {
+        long long periodStart;
+        int count = periodDays(rule, firstDay, period, days, &periodStart);
+        if (periodStart > lastDay) {
+            return;
+        }
+        for (int i = 0; i < count; i++) {
+            long long start = days[i] * 1440 + timeOfDay;
+            if (start < first) {
+                continue;
+            }
+            if ((rule->hasCount && ++seen > rule->count) || start > high) {
+                return;
+            }
+            if (start >= low) {
+                Timestamp occurrence = minutesToTimestamp(start);
+                if (!isExcluded(event, occurrence)) {
+                    addEvent(store, occurrence, minutesToTimestamp(start + duration), &event->summary, &event->location);
+                }
+            }
+        }
+    }
+}
+
+
+// adds a parsed event to the store if it takes place inside the range; a recurring event adds its occurrences there
+void collectEvent(const ParsedEvent* event, Timestamp from, Timestamp to, EventStore* store) {
+    if (!event->hasStart) {
+        return;
+    }
+    if (event->hasRule) {
+        expandEvent(event, from, to, store);
+    } else if ((from <= event->start) && (to >= event->end)) {
+        addEvent(store, event->start, event->end, &event->summary, &event->location);
+    }
+}
+
+
+// reads an input file line by line, extracts specific information, and closes it
+// arguments: fileNameArg, the Timestamp range events must start and end in, and the store that collects them
+//process each event separately: it is filtered as soon as its END:VEVENT line is read, and only the events
+//in range are kept, so the input does not need to be in chronological order
+void processFile(const char* fileNameArg, Timestamp from, Timestamp to, EventStore* store) {
+    StatsMark mark = statsNow();
+    FILE* file = fopen(fileNameArg, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open file %s for reading.\n", fileNameArg);
+        return;
+    }
+    LineReader reader;
+    ParsedEvent event = { 0 };
+
+    openReader(&reader, file, READ_BUFFER_SIZE);
+    while (readEvent(&reader, &event, from, to)) {
+        collectEvent(&event, from, to, store);
+    }
+    freeParsedEvent(&event);
+    closeReader(&reader);
+    fclose(file);
+    chargeStage(STAGE_SCAN, &mark);
+}
+
+// a byte range of the .ics file scanned by one thread, the filtered events found in it, and the --stats of the scan
+// an event belongs to the range its BEGIN:VEVENT line starts in, even if the rest of it lies past the end
+typedef struct {
+    const char* fileName;
+    long long begin;
+    long long end;
+    Timestamp from;
+    Timestamp to;
+    EventStore store;
+    Stats stats;
+    int failed;
+} ScanChunk;
+
+
+// moves a reader to the first line that starts at or after offset, so a chunk never begins inside a line
+void alignReader(LineReader* reader, long long offset) {
+    if (offset == 0) {
+        seekReader(reader, 0);
+        return;
+    }
+    seekReader(reader, offset - 1);
+    while (fillBuffer(reader)) {
+        char* newline = memchr(reader->buffer + reader->pos, '\n', reader->end - reader->pos);
+        if (newline != NULL) {
+            reader->pos = (size_t)(newline - reader->buffer) + 1;
+            return;
+        }
+        reader->pos = reader->end;
+    }
+}
+
+
+// thread body: reads the events that begin in one chunk through its own file handle and keeps those in range
+// the work is counted apart from whatever the thread counted before, so a chunk scanned on the main thread is not
+// counted twice when the chunks are joined
+void* scanChunk(void* arg) {
+    ScanChunk* chunk = arg;
+    Stats outer = threadStats;
+    StatsMark mark = statsNow();
+    FILE* file = fopen(chunk->fileName, "r");
+    if (file == NULL) {
+        chunk->failed = 1;
+        return NULL;
+    }
+    LineReader reader;
+    ParsedEvent event = { 0 };
+
+    memset(&threadStats, 0, sizeof(Stats));
+    openReader(&reader, file, READ_BUFFER_SIZE);
+    alignReader(&reader, chunk->begin);
+    while (readEvent(&reader, &event, chunk->from, chunk->to) && event.offset < chunk->end) {
+        collectEvent(&event, chunk->from, chunk->to, &chunk->store);
+    }
+    freeParsedEvent(&event);
+    closeReader(&reader);
+    fclose(file);
+    chargeStage(STAGE_SCAN, &mark);
+    chunk->stats = threadStats;
+    threadStats = outer;
+    return NULL;
+}
+
+
+// moves the events of one store to the end of another, rebasing their string offsets
+void appendEvents(EventStore* store, EventStore* other) {
+    size_t base = store->strings.len;
+    if (other->count == 0) {
+        return;
+    }
+    appendText(&store->strings, other->strings.data, other->strings.len);
+    for (size_t i = 0; i < other->count; i++) {
+        Event* event = &other->events[i];
+        event->summary += base;
+        event->location += base;
+    }
+    if (store->count + other->count > store->cap) {
+        size_t cap = store->count + other->count;
+        Event* events = realloc(store->events, cap * sizeof(Event));
+        STATS_ALLOCATION(cap * sizeof(Event));
+        if (events == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        store->events = events;
+        store->cap = cap;
+    }
+    memcpy(store->events + store->count, other->events, other->count * sizeof(Event));
+    store->count += other->count;
+}
+
+
+// scans the file with several threads: it is cut into one byte range per thread, every thread parses and filters
+// the events that begin in its range, and the results are joined in file order, so after the stable sort the output
+// is the same as with a single thread
+void processFileParallel(const char* fileNameArg, Timestamp from, Timestamp to, EventStore* store, int threads) {
+    struct stat st;
+    if (stat(fileNameArg, &st) != 0 || threads < 2) {
+        processFile(fileNameArg, from, to, store);
+        return;
+    }
+    // a range smaller than one read buffer is not worth a thread
+    long long size = (long long)st.st_size;
+    if (threads > size / READ_BUFFER_SIZE) {
+        threads = (int)(size / READ_BUFFER_SIZE);
+    }
+    if (threads < 2) {
+        processFile(fileNameArg, from, to, store);
+        return;
+    }
+
+    ScanChunk* chunks = calloc(threads, sizeof(ScanChunk));
+    pthread_t* ids = malloc(threads * sizeof(pthread_t));
+    if (chunks == NULL || ids == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < threads; i++) {
+        chunks[i].fileName = fileNameArg;
+        chunks[i].begin = size * i / threads;
+        chunks[i].end = size * (i + 1) / threads;
+        chunks[i].from = from;
+        chunks[i].to = to;
+    }
+    int started = 0;
+    for (; started < threads; started++) {
+        if (pthread_create(&ids[started], NULL, scanChunk, &chunks[started]) != 0) {
+            break;
+        }
+    }
+    // chunks that could not get a thread are scanned here
+    for (int i = started; i < threads; i++) {
+        scanChunk(&chunks[i]);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(ids[i], NULL);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < threads; i++) {
+        failed |= chunks[i].failed;
+        addStats(&chunks[i].stats);
+        appendEvents(store, &chunks[i].store);
+        freeEvents(&chunks[i].store);
+    }
+    if (failed) {
+        fprintf(stderr, "Failed to open file %s for reading.\n", fileNameArg);
+    }
+    free(ids);
+    free(chunks);
+}
+
+
+// size of the reads made when jumping to single events through the index
+#define INDEX_READ_SIZE 4096
+
+// a query visiting more than one event in this many reads the file in READ_BUFFER_SIZE blocks instead
+#define INDEX_DENSE_FRACTION 8
+
+
+// an entry of the date index sidecar: where one event starts in the .ics file and when it takes place
+// for a recurring event, end is the latest time any of its occurrences can end
+typedef struct {
+    Timestamp start;
+    Timestamp end;
+    long long offset;
+} IndexEntry;
+
+
+// the header of the date index sidecar; the index is only used while the size and modification time it
+// records still match the .ics file
+// it is followed by count single events sorted by start time, then the recurring events in file order
+typedef struct {
+    char magic[8];
+    long long size;
+    long long mtimeSec;
+    long long mtimeNsec;
+    long long count;
+    long long recurring;
+} IndexHeader;
+
+
+// identifies a date index sidecar and its layout
+#define INDEX_MAGIC "EVIDX02"
+
+
+// builds the name of the date index sidecar of an .ics file; the caller frees it
+char* indexFileName(const char* fileName) {
+    char* name = malloc(strlen(fileName) + 5);
+    if (name == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    strcpy(name, fileName);
+    strcat(name, ".idx");
+    return name;
+}
+
+
+// fills in the identity of the .ics file an index header describes; returns 0 if the file cannot be examined
+int describeFile(const char* fileName, IndexHeader* header) {
+    struct stat st;
+    if (stat(fileName, &st) != 0) {
+        return 0;
+    }
+    memset(header, 0, sizeof(IndexHeader));
+    memcpy(header->magic, INDEX_MAGIC, sizeof(header->magic));
+    header->size = (long long)st.st_size;
+    header->mtimeSec = (long long)st.st_mtim.tv_sec;
+    header->mtimeNsec = (long long)st.st_mtim.tv_nsec;
+    return 1;
+}
+
+
+// appends an entry to a growing array of index entries
+void addIndexEntry(IndexEntry** entries, size_t* count, size_t* cap, Timestamp start, Timestamp end, long long offset) {
+    if (*count == *cap) {
+        *cap = *cap > 0 ? *cap * 2 : 1024;
+        *entries = realloc(*entries, *cap * sizeof(IndexEntry));
+        STATS_ALLOCATION(*cap * sizeof(IndexEntry));
+        if (*entries == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    (*entries)[*count].start = start;
+    (*entries)[*count].end = end;
+    (*entries)[*count].offset = offset;
+    (*count)++;
+}
+
+
+// scans the whole .ics file and writes its date index sidecar: one entry per event, sorted by start time
+// the sidecar is written to a temporary file first and renamed over the old one, so readers never see half of it
+int buildIndex(const char* fileNameArg) {
+    IndexHeader header;
+    FILE* file = fopen(fileNameArg, "r");
+    if (file == NULL || !describeFile(fileNameArg, &header)) {
+        fprintf(stderr, "Failed to open file %s for reading.\n", fileNameArg);
+        if (file != NULL) {
+            fclose(file);
+        }
+        return 0;
+    }
+
+    LineReader reader;
+    ParsedEvent event = { 0 };
+    IndexEntry* entries = NULL;
+    IndexEntry* recurring = NULL;
+    size_t count = 0, cap = 0, numRecurring = 0, recurringCap = 0;
+
+    openReader(&reader, file, READ_BUFFER_SIZE);
+    while (readEvent(&reader, &event, 0, TIMESTAMP_LATEST)) {
+        if (!event.hasStart) {
+            continue;
+        }
+        if (event.hasRule) {
+            // without UNTIL a recurring event can have occurrences in any range that does not end before it starts
+            Timestamp last = makeTimestamp(9999, 12, 31, 23, 59);
+            if (event.rule.hasUntil) {
+                last = minutesToTimestamp(timestampToMinutes(event.rule.until) + timestampToMinutes(event.end) - timestampToMinutes(event.start));
+            }
+            addIndexEntry(&recurring, &numRecurring, &recurringCap, event.start, last, event.offset);
+        } else {
+            addIndexEntry(&entries, &count, &cap, event.start, event.end, event.offset);
+        }
+    }
+    freeParsedEvent(&event);
+    closeReader(&reader);
+    fclose(file);
+    radixSortByStart(entries, count, sizeof(IndexEntry));
+
+    char* indexName = indexFileName(fileNameArg);
+    char* tempName = malloc(strlen(indexName) + 5);
+    if (tempName == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    strcpy(tempName, indexName);
+    strcat(tempName, ".tmp");
+
+    header.count = (long long)count;
+    header.recurring = (long long)numRecurring;
+    FILE* out = fopen(tempName, "wb");
+    int ok = out != NULL &&
+             fwrite(&header, sizeof(header), 1, out) == 1 &&
+             (count == 0 || fwrite(entries, sizeof(IndexEntry), count, out) == count) &&
+             (numRecurring == 0 || fwrite(recurring, sizeof(IndexEntry), numRecurring, out) == numRecurring);
+    if (out != NULL && fclose(out) != 0) {
+        ok = 0;
+    }
+    if (ok && rename(tempName, indexName) != 0) {
+        ok = 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to write index %s.\n", indexName);
+        remove(tempName);
+    }
+    free(tempName);
+    free(indexName);
+    free(entries);
+    free(recurring);
+    return ok;
+}
+
+
+// orders index entries by their position in the .ics file
+int compareEntryOffsets(const void* a, const void* b) {
+    long long x = ((const IndexEntry*)a)->offset, y = ((const IndexEntry*)b)->offset;
+    return (x > y) - (x < y);
+}
+
+
+// answers a query from the date index sidecar: binary-searches the first single event starting in range, adds the
+// recurring events that can have occurrences in it, then reads only those VEVENT blocks. they are read in file order,
+// so the events come out exactly as a full scan would find them, and a block already in the read buffer costs no read.
+// a few blocks are reached with a seek and a small read each; when many are visited, reads are as large as a scan's
+// returns 0, leaving the store empty, if there is no index or it no longer matches the .ics file
+int queryIndex(const char* fileNameArg, Timestamp from, Timestamp to, EventStore* store) {
+    IndexHeader expected, header;
+    if (!describeFile(fileNameArg, &expected)) {
+        return 0;
+    }
+    char* indexName = indexFileName(fileNameArg);
+    FILE* indexFile = fopen(indexName, "rb");
+    free(indexName);
+    if (indexFile == NULL) {
+        return 0;
+    }
+    if (fread(&header, sizeof(header), 1, indexFile) != 1 ||
+        memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 ||
+        header.size != expected.size || header.mtimeSec != expected.mtimeSec ||
+        header.mtimeNsec != expected.mtimeNsec || header.count < 0 || header.recurring < 0) {
+        fclose(indexFile);
+        return 0;
+    }
+
+    size_t count = (size_t)header.count, total = count + (size_t)header.recurring;
+    IndexEntry* entries = malloc((total > 0 ? total : 1) * sizeof(IndexEntry));
+    IndexEntry* visits = malloc((total > 0 ? total : 1) * sizeof(IndexEntry));
+    STATS_ALLOCATION(2 * (total > 0 ? total : 1) * sizeof(IndexEntry));
+    if (entries == NULL || visits == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    int ok = fread(entries, sizeof(IndexEntry), total, indexFile) == total;
+    fclose(indexFile);
+
+    // first single event that starts at or after the beginning of the range
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (entries[mid].start < from) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    size_t numVisits = 0;
+    for (size_t i = low; i < count && entries[i].start <= to; i++) {
+        if (entries[i].end <= to) {
+            visits[numVisits++] = entries[i];
+        }
+    }
+    for (size_t i = count; i < total; i++) {
+        if (entries[i].start <= to && entries[i].end >= from) {
+            visits[numVisits++] = entries[i];
+        }
+    }
+    qsort(visits, numVisits, sizeof(IndexEntry), compareEntryOffsets);
+
+    FILE* file = ok ? fopen(fileNameArg, "r") : NULL;
+    if (file != NULL) {
+        LineReader reader;
+        ParsedEvent event = { 0 };
+
+        openReader(&reader, file, numVisits > total / INDEX_DENSE_FRACTION ? READ_BUFFER_SIZE : INDEX_READ_SIZE);
+        for (size_t i = 0; ok && i < numVisits; i++) {
+            advanceReader(&reader, visits[i].offset);
+            // an event that is not where the index says means the file changed under the same size and time
+            ok = readEvent(&reader, &event, from, to) && event.offset == visits[i].offset && event.hasStart &&
+                 event.start == visits[i].start && (event.hasRule || event.end == visits[i].end);
+            if (ok) {
+                collectEvent(&event, from, to, store);
+            }
+        }
+        freeParsedEvent(&event);
+        closeReader(&reader);
+        fclose(file);
+    } else {
+        ok = 0;
+    }
+    free(visits);
+    free(entries);
+    if (!ok) {
+        store->count = 0;
+        store->strings.len = 0;
+    }
+    return ok;
+}
+
+
+
+// the position of the merge in one calendar's sorted events
+typedef struct {
+    const EventStore* store;
+    size_t next;
+} CalendarCursor;
+
+
+// checks whether the next event of calendar a comes before that of calendar b; calendars given first win ties
+int cursorBefore(const CalendarCursor* cursors, int a, int b) {
+    Timestamp x = cursors[a].store->events[cursors[a].next].start;
+    Timestamp y = cursors[b].store->events[cursors[b].next].start;
+    return x < y || (x == y && a < b);
+}
+
+
+// moves a calendar down a min-heap of calendar numbers until it is no later than its children
+void siftCalendar(const CalendarCursor* cursors, int* heap, int size, int i) {
+    for (;;) {
+        int smallest = i, left = 2 * i + 1, right = left + 1;
+        if (left < size && cursorBefore(cursors, heap[left], heap[smallest])) {
+            smallest = left;
+        }
+        if (right < size && cursorBefore(cursors, heap[right], heap[smallest])) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        int swap = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+
+// prints the events of several calendars, each already sorted by start time, as one day-grouped list
+// a k-way merge through a min-heap keyed on the next start time of every calendar, so nothing is sorted twice
+void printMergedEvents(const EventStore* stores, int count) {
+    CalendarCursor* cursors = malloc((count > 0 ? count : 1) * sizeof(CalendarCursor));
+    int* heap = malloc((count > 0 ? count : 1) * sizeof(int));
+    int size = 0;
+    if (cursors == NULL || heap == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+        cursors[i].store = &stores[i];
+        cursors[i].next = 0;
+        if (stores[i].count > 0) {
+            heap[size++] = i;
+        }
+    }
+    for (int i = size / 2 - 1; i >= 0; i--) {
+        siftCalendar(cursors, heap, size, i);
+    }
+    while (size > 0) {
+        CalendarCursor* cursor = &cursors[heap[0]];
+        const Event* event = &cursor->store->events[cursor->next++];
+        printFormattedDateTime(event->start, event->end, cursor->store->strings.data + event->summary, cursor->store->strings.data + event->location);
+        if (cursor->next == cursor->store->count) {
+            heap[0] = heap[--size];
+        }
+        siftCalendar(cursors, heap, size, 0);
+    }
+    free(heap);
+    free(cursors);
+}
+
+
+// reads the events of one calendar that fall in the range into a store, sorted by start time
+// a valid date index answers the query without scanning the whole file
+// the scan is timed inside processFile and scanChunk, so the share of every scan thread is counted
+void loadCalendar(const char* fileName, Timestamp from, Timestamp to, EventStore* store) {
+    StatsMark mark = statsNow();
+    int indexed = queryIndex(fileName, from, to, store);
+    chargeStage(STAGE_INDEX, &mark);
+    if (!indexed) {
+        processFileParallel(fileName, from, to, store, threadsArg);
+        mark = statsNow();
+    }
+    sortEvents(store);
+    chargeStage(STAGE_SORT, &mark);
+}
+
+// the inotify events that tell a followed calendar grew, and those that tell it may have been replaced
+#define FOLLOW_FILE_EVENTS (IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF | IN_ATTRIB)
+#define FOLLOW_REPLACE_EVENTS (IN_MOVE_SELF | IN_DELETE_SELF | IN_ATTRIB)
+
+// the inotify events of a directory that tell a file was created or renamed into it
+#define FOLLOW_DIRECTORY_EVENTS (IN_CREATE | IN_MOVED_TO)
+
+// how many bytes before the end of the last complete event are kept to tell a calendar that grew from one rewritten
+#define FOLLOW_TAIL_SIZE 64
+
+
+// a calendar watched by --follow: its open file and how far into it the complete events have been read
+// printed is an open-addressing set of fingerprints of the occurrences printed so far, 0 marking a free slot, so a
+// calendar that is rewritten can be read again from the start without printing the same occurrence twice
+typedef struct {
+    const char* fileName;
+    const char* baseName;  // the name the directory watch reports the calendar under
+    FILE* file;
+    LineReader reader;
+    ParsedEvent event;
+    long long consumed;  // offset just past the last complete VEVENT
+    char tail[FOLLOW_TAIL_SIZE];  // the bytes just before consumed
+    int tailLen;
+    int watch;
+    int directoryWatch;
+    int changed;         // set when inotify reports a write that has not been read yet
+    int replaced;        // set when the calendar may have been renamed, deleted or replaced
+    unsigned long long* printed;
+    size_t numPrinted;
+    size_t printedCap;
+} Follower;
+
+
+// a fingerprint of an occurrence: FNV-1a over its times, summary and location, never 0
+unsigned long long fingerprintEvent(const EventStore* store, const Event* event) {
+    unsigned long long hash = 14695981039346656037ULL;
+    const Timestamp times[2] = { event->start, event->end };
+    const unsigned char* bytes = (const unsigned char*)times;
+
+    for (size_t i = 0; i < sizeof(times); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    // both strings are hashed with their terminating NUL, so "ab" + "c" and "a" + "bc" differ
+    const char* strings[2] = { store->strings.data + event->summary, store->strings.data + event->location };
+    for (int s = 0; s < 2; s++) {
+        const unsigned char* c = (const unsigned char*)strings[s];
+        do {
+            hash = (hash ^ *c) * 1099511628211ULL;
+        } while (*c++ != '\0');
+    }
+    return hash != 0 ? hash : 1;
+}
+
+
+// adds a fingerprint to the printed set of a calendar; returns 0 if it was already there
+int rememberPrinted(Follower* follower, unsigned long long fingerprint) {
+    if (2 * (follower->numPrinted + 1) > follower->printedCap) {
+        size_t cap = follower->printedCap > 0 ? follower->printedCap * 2 : 1024;
+        unsigned long long* printed = calloc(cap, sizeof(unsigned long long));
+        STATS_ALLOCATION(cap * sizeof(unsigned long long));
+        if (printed == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < follower->printedCap; i++) {
+            if (follower->printed[i] != 0) {
+                size_t slot = follower->printed[i] & (cap - 1);
+                while (printed[slot] != 0) {
+                    slot = (slot + 1) & (cap - 1);
+                }
+                printed[slot] = follower->printed[i];
+            }
+        }
+        free(follower->printed);
+        follower->printed = printed;
+        follower->printedCap = cap;
+    }
+    size_t slot = fingerprint & (follower->printedCap - 1);
+    while (follower->printed[slot] != 0) {
+        if (follower->printed[slot] == fingerprint) {
+            return 0;
+        }
+        slot = (slot + 1) & (follower->printedCap - 1);
+    }
+    follower->printed[slot] = fingerprint;
+    follower->numPrinted++;
+    return 1;
+}
+
+
+// drops the occurrences of a store that were already printed for the calendar, keeping the others in order
+void dropPrinted(Follower* follower, EventStore* store) {
+    size_t kept = 0;
+    for (size_t i = 0; i < store->count; i++) {
+        if (rememberPrinted(follower, fingerprintEvent(store, &store->events[i]))) {
+            store->events[kept++] = store->events[i];
+        }
+    }
+    store->count = kept;
+}
+
+
+// reads the FOLLOW_TAIL_SIZE bytes (fewer near the start of the file) that end at an offset; returns how many it read
+int readTail(FILE* file, long long end, char* tail) {
+    long long len = end < FOLLOW_TAIL_SIZE ? end : FOLLOW_TAIL_SIZE;
+    ssize_t got = len > 0 ? pread(fileno(file), tail, (size_t)len, (off_t)(end - len)) : 0;
+    return got == len ? (int)len : -1;
+}
+
+
+// reads the events appended to a followed calendar since the last call and keeps those in range
+// reading resumes at the end of the last complete event, so an event still being written is read again once it is
+// finished. a calendar that no longer holds the bytes read last time, because it shrank or was rewritten in place,
+// is read again from the start, and only the occurrences that were not printed before are kept
+void readAppended(Follower* follower, Timestamp from, Timestamp to, EventStore* store) {
+    struct stat st;
+    char tail[FOLLOW_TAIL_SIZE];
+    if (fstat(fileno(follower->file), &st) != 0 || (long long)st.st_size < follower->consumed ||
+        readTail(follower->file, follower->consumed, tail) != follower->tailLen ||
+        memcmp(tail, follower->tail, (size_t)follower->tailLen) != 0) {
+        follower->consumed = 0;
+    }
+    seekReader(&follower->reader, follower->consumed);
+    while (readEvent(&follower->reader, &follower->event, from, to)) {
+        collectEvent(&follower->event, from, to, store);
+        follower->consumed = follower->event.next;
+    }
+    follower->tailLen = readTail(follower->file, follower->consumed, follower->tail);
+    dropPrinted(follower, store);
+}
+
+
+// switches a followed calendar to the file now found under its name when that is not the file already open, as
+// after an editor saved it by writing a new file and renaming it over the old one. the new file is read from the
+// start. a calendar that is gone for now is picked up again by the directory watch once it is back
+void reopenFollower(Follower* follower, int notify) {
+    struct stat opened, current;
+    FILE* file = fopen(follower->fileName, "r");
+    if (file == NULL) {
+        return;
+    }
+    if (fstat(fileno(follower->file), &opened) == 0 && fstat(fileno(file), &current) == 0 &&
+        opened.st_dev == current.st_dev && opened.st_ino == current.st_ino) {
+        fclose(file);
+        return;
+    }
+    inotify_rm_watch(notify, follower->watch);
+    follower->watch = inotify_add_watch(notify, follower->fileName, FOLLOW_FILE_EVENTS);
+    fclose(follower->file);
+    follower->file = file;
+    follower->reader.file = file;
+    follower->consumed = 0;
+    follower->tailLen = 0;
+    follower->changed = 1;
+}
+
+
+// watches the directory of a followed calendar for files created or renamed into it; returns the watch, or -1
+int watchDirectory(int notify, Follower* follower) {
+    const char* slash = strrchr(follower->fileName, '/');
+    follower->baseName = slash != NULL ? slash + 1 : follower->fileName;
+    if (slash == NULL) {
+        return inotify_add_watch(notify, ".", FOLLOW_DIRECTORY_EVENTS);
+    }
+    char* directory = strndup(follower->fileName, slash == follower->fileName ? 1 : (size_t)(slash - follower->fileName));
+    if (directory == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    int watch = inotify_add_watch(notify, directory, FOLLOW_DIRECTORY_EVENTS);
+    free(directory);
+    return watch;
+}
+
+
+// closes the calendars of --follow and releases their readers, stores and printed sets, and the inotify instance
+void releaseFollowers(Follower* followers, EventStore* stores, int count, int notify) {
+    for (int i = 0; i < count; i++) {
+        if (followers[i].file != NULL) {
+            fclose(followers[i].file);
+        }
+        closeReader(&followers[i].reader);
+        freeParsedEvent(&followers[i].event);
+        free(followers[i].printed);
+        freeEvents(&stores[i]);
+    }
+    if (notify >= 0) {
+        close(notify);
+    }
+    free(followers);
+    free(stores);
+}
+
+
+// size of the buffer inotify notifications are read into
+#define NOTIFY_BUFFER_SIZE 4096
+
+
+// --follow: prints the events in range, then waits on inotify for the calendars to change and prints the events
+// added to them as they arrive. each update only reads the bytes past the last complete event, unless the calendar
+// was rewritten or replaced; a calendar is followed by name, so one saved by renaming a new file over it is reopened
+// returns only if the calendars cannot be watched
+int followCalendars(char** fileNames, int count, Timestamp from, Timestamp to) {
+    Follower* followers = calloc(count, sizeof(Follower));
+    EventStore* stores = calloc(count, sizeof(EventStore));
+    int notify = inotify_init();
+    if (followers == NULL || stores == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    int ok = notify >= 0;
+    if (!ok) {
+        fprintf(stderr, "Failed to watch the calendars.\n");
+    }
+    for (int i = 0; ok && i < count; i++) {
+        followers[i].fileName = fileNames[i];
+        followers[i].file = fopen(fileNames[i], "r");
+        if (followers[i].file == NULL) {
+            fprintf(stderr, "Failed to open file %s for reading.\n", fileNames[i]);
+            ok = 0;
+            break;
+        }
+        followers[i].watch = inotify_add_watch(notify, fileNames[i], FOLLOW_FILE_EVENTS);
+        followers[i].directoryWatch = watchDirectory(notify, &followers[i]);
+        if (followers[i].watch < 0 || followers[i].directoryWatch < 0) {
+            fprintf(stderr, "Failed to watch file %s.\n", fileNames[i]);
+            ok = 0;
+            break;
+        }
+        openReader(&followers[i].reader, followers[i].file, READ_BUFFER_SIZE);
+        followers[i].changed = 1;
+    }
+
+    // the first pass reads every calendar from the start, later passes only the calendars that changed
+    char notifications[NOTIFY_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (ok) {
+        for (int i = 0; i < count; i++) {
+            if (followers[i].replaced) {
+                followers[i].replaced = 0;
+                reopenFollower(&followers[i], notify);
+            }
+            if (followers[i].changed) {
+                followers[i].changed = 0;
+                readAppended(&followers[i], from, to, &stores[i]);
+                sortEvents(&stores[i]);
+            }
+        }
+        printMergedEvents(stores, count);
+        flushOutput();
+        fflush(stdout);
+        for (int i = 0; i < count; i++) {
+            stores[i].count = 0;
+            stores[i].strings.len = 0;
+        }
+
+        ssize_t length = read(notify, notifications, sizeof(notifications));
+        if (length <= 0) {
+            fprintf(stderr, "Failed to watch the calendars.\n");
+            ok = 0;
+            break;
+        }
+        for (char* p = notifications; p < notifications + length; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+            const struct inotify_event* notification = (const struct inotify_event*)p;
+            for (int i = 0; i < count; i++) {
+                if (followers[i].watch == notification->wd) {
+                    followers[i].changed = 1;
+                    followers[i].replaced |= (notification->mask & FOLLOW_REPLACE_EVENTS) != 0;
+                } else if (followers[i].directoryWatch == notification->wd && notification->len > 0 &&
+                           strcmp(notification->name, followers[i].baseName) == 0) {
+                    followers[i].replaced = 1;
+                }
+            }
+        }
+    }
+    releaseFollowers(followers, stores, count, notify);
+    return 1;
+}
+
+ 
+
+// main Function
+int main(int argc, char* argv[]) { 
+    extractArguments(argc, argv);
+    if (numFileArgs == 0) {
+        fprintf(stderr, "Missing --file argument.\n");
+        return 1;
+    }
+    if (!formatDateToInt()) {
+        return 1;
+    }
+    if (followArg) {
+        return followCalendars(fileNameArgs, numFileArgs, rangeStart, rangeEnd);
+    }
+    // every calendar is filtered and sorted on its own, then the calendars are merged while printing
+    StatsMark start = statsNow(), mark = start;
+    EventStore* stores = calloc(numFileArgs, sizeof(EventStore));
+    if (stores == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < numFileArgs; i++) {
+        if (buildIndexArg) {
+            mark = statsNow();
+            if (!buildIndex(fileNameArgs[i])) {
+                return 1;
+            }
+            chargeStage(STAGE_INDEX, &mark);
+        }
+        loadCalendar(fileNameArgs[i], rangeStart, rangeEnd, &stores[i]);
+    }
+    mark = statsNow();
+    printMergedEvents(stores, numFileArgs);
+    flushOutput();
+    chargeStage(STAGE_OUTPUT, &mark);
+    if (statsArg != NULL) {
+        reportStats(statsArg, start);
+    }
+    for (int i = 0; i < numFileArgs; i++) {
+        freeEvents(&stores[i]);
+        free(fileNameArgs[i]);
+    }
+    free(stores);
+    free(fileNameArgs);
      
     return 0;
 }
\ No newline at end of file
@@ -11,11 +11,53 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "list.h"
-#include "list.c"
-
-#define MAX_LINE_LEN 180
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
  
+/**
+ * @brief A song of the output list: its artist, title and year, and the value it is sorted by.
+ */
+typedef struct node_t {
+    char* artist;
+    char* song;
+    int year;
+    float sorting;
+    struct node_t* next;
+} node_t;
+
+/**
+ * Function: emalloc
+ * -----------------
+ * @brief Allocates a block of memory, exiting the program if it cannot.
+ *
+ * @return void* A pointer to the new block.
+ */
+void* emalloc(size_t n) {
+    void* p = malloc(n);
+    if (p == NULL && n > 0) {
+        fprintf(stderr, "malloc of %zu bytes failed\n", n);
+        exit(1);
+    }
+    return p;
+}
+
 /**
  * @brief An struct that encapsulates program arguments such as sorting, display preferences, file names, and numerical parameters like energy and danceability.
  */
@@ -26,8 +68,46 @@ typedef struct {
     int numFiles;
     float energy;          
     float danceability;    
+    int threads;
+    char* output;
+    char* stats;
+    char* serve;
+    int snapshot;
 } Options;
 
+/**
+ * Function: parse_files
+ * ---------------------
+ * @brief Parses command-line arguments to extract file names.
+ *
+ * @param argc The number of command-line arguments.
+ * @param argv An array of strings containing the command-line arguments.
+ * @param numFiles A pointer to an integer, used to store the count of files found.
+ *
+ * @return char** An array of strings containing the extracted file names, or NULL if the "--files" option is not found.
+ */ 
+char** parse_files(int argc, char* argv[], int* numFiles) {
+    char** files = NULL;
+    *numFiles = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--files=", 8) == 0) {
+            char* filesArg = strdup(argv[i] + 8);
+            char* token = strtok(filesArg, ",");
+            while (token != NULL) {
+                files = realloc(files, (*numFiles + 1) * sizeof(char*));
+                files[*numFiles] = strdup(token);
+                (*numFiles)++;
+                token = strtok(NULL, ",");
+            }
+            free(filesArg);
+            return files;
+        }
+    }
+
+    return NULL;  
+}
+
 /**
  * Function: parse_arguments
  * -------------------------
@@ -46,732 +126,3649 @@ Options parse_arguments(int argc, char* argv[]) {
     options.numFiles = 0;
     options.energy = 0.0;          
     options.danceability = 0.0;      
+    options.threads = 1;
+    options.output = NULL;
+    options.stats = NULL;
+    options.serve = NULL;
+    options.snapshot = 0;
 
     for (int i = 1; i < argc; i++) {
         if (strncmp(argv[i], "--sortBy=", 9) == 0) {
             options.sortBy = strdup(argv[i] + 9);
         } else if (strncmp(argv[i], "--display=", 10) == 0) {
             options.display = atoi(argv[i] + 10);
-        } else if (strncmp(argv[i], "--files=", 8) == 0) {
-            char* filesArg = strdup(argv[i] + 8);
-            char* token = strtok(filesArg, ",");
-            while (token != NULL) {
-                options.files = realloc(options.files, (options.numFiles + 1) * sizeof(char*));
-                options.files[options.numFiles] = strdup(token);
-                options.numFiles++;
-                token = strtok(NULL, ",");
-            }
-            free(filesArg);
         } else if (strncmp(argv[i], "--energy=", 9) == 0) {
             options.energy = atof(argv[i] + 9);
         } else if (strncmp(argv[i], "--danceability=", 15) == 0) {
             options.danceability = atof(argv[i] + 15);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            options.threads = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--output=", 9) == 0) {
+            options.output = strdup(argv[i] + 9);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            options.stats = strdup("-");
+        } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+            options.stats = strdup(argv[i] + 8);
+        } else if (strncmp(argv[i], "--serve=", 8) == 0) {
+            options.serve = strdup(argv[i] + 8);
+        } else if (strcmp(argv[i], "--snapshot") == 0) {
+            options.snapshot = 1;
         }
     }
+    options.files = parse_files(argc, argv, &options.numFiles);
 
     return options;
 }
 
 /**
- * Function: print_next_nodes
- * --------------------------
- * @brief Prints a specified number of next nodes from the linked list and writes the data to a CSV file.
- *
- * @param list A pointer to the head of the linked list.
- * @param display The number of nodes to display and write to the CSV file.
- * @param options The Options struct containing configuration settings.
+ * @brief The stages of a run that --stats times.
  */
-void print_next_nodes(node_t* list, int display, Options options) {
-    node_t* current = list;
-    int count = 0;
+enum {
+    STAGE_MAP,
+    STAGE_PARSE,
+    STAGE_SELECT,
+    STAGE_SORT,
+    STAGE_MERGE,
+    STAGE_MATERIALIZE,
+    STAGE_OUTPUT,
+    STAGE_SNAPSHOT,
+    NUM_STAGES
+};
 
-    FILE* output_file = fopen("output.csv", "w");
-    if (output_file == NULL) {
-        printf("Failed to open output.csv for writing.\n");
-        return;
-    }
-    fprintf(output_file, "artist,song,year,%s\n", options.sortBy);
-    while (current != NULL && count < display) {
-        fprintf(output_file, "%s,%s,%d,%g\n", current->artist, current->song, current->year, current->sorting);
-        current = current->next;
-        count++;
-    }
-    free(options.sortBy);
-    for (int i = 0; i < options.numFiles; i++) {
-        free(options.files[i]);
-    }
-    free(options.files);
+/**
+ * @brief The names of the stages in the --stats report.
+ */
+const char* const STAGE_NAMES[NUM_STAGES] = {
+    "map", "parse", "select", "sort", "merge", "materialize", "output", "snapshot"
+};
 
-    fclose(output_file);
-}
+/**
+ * @brief The counters --stats reports.
+ */
+enum {
+    COUNT_BYTES_READ,
+    COUNT_ROWS_PARSED,
+    COUNT_ROWS_REJECTED,
+    COUNT_FIELDS_SPLIT,
+    COUNT_NUMBERS_PARSED,
+    COUNT_NUMBERS_SLOW_PATH,
+    COUNT_ALLOCATIONS,
+    COUNT_BYTES_ALLOCATED,
+    COUNT_ARENA_ALLOCATIONS,
+    COUNT_HEAP_OFFERS,
+    COUNT_HEAP_PUSHES,
+    COUNT_HEAP_EVICTIONS,
+    COUNT_LIST_NODES,
+    COUNT_BYTES_WRITTEN,
+    COUNT_SNAPSHOT_ROWS,
+    COUNT_SORT_ROWS,
+    COUNT_SORT_PASSES,
+    COUNT_SORT_FALLBACK_ROWS,
+    NUM_COUNTERS
+};
 
 /**
- * Function: openFileForReading
- * ---------------------------
- * @brief Opens a file for reading and returns a pointer to the file stream.
- *
- * @param filename The name of the file to be opened for reading.
- *
- * @return FILE* A pointer to the `FILE` structure representing the file stream if the file was opened successfully,
- *         or NULL if the file could not be opened.
+ * @brief The names of the counters in the --stats report.
+ */
+const char* const COUNTER_NAMES[NUM_COUNTERS] = {
+    "bytes_read", "rows_parsed", "rows_rejected", "fields_split", "numbers_parsed", "numbers_slow_path",
+    "allocations", "bytes_allocated", "arena_allocations", "heap_offers", "heap_pushes", "heap_evictions",
+    "list_nodes", "bytes_written", "snapshot_rows", "sort_rows", "sort_passes", "sort_fallback_rows"
+};
+
+/**
+ * @brief The stage times and counters of one thread.
  *
- */ 
-FILE* openFileForReading(const char* filename) {
-    FILE* file = fopen(filename, "r");
-    if (file == NULL) {
-        printf("Failed to open file %s for reading.\n", filename);
-    }
-    return file;
-}
+ * Every thread counts into its own copy, so the parser updates them with plain increments and no locks or
+ * atomics. The copies of the ingest threads are added to the main thread's when the threads are joined, which
+ * makes the times of the parse and select stages the sum over all threads.
+ */
+typedef struct {
+    double wall[NUM_STAGES];
+    double cpu[NUM_STAGES];
+    unsigned long long counters[NUM_COUNTERS];
+} Stats;
 
 /**
- * Function: parseLine
+ * @brief The stage times and counters of the calling thread.
+ */
+_Thread_local Stats threadStats;
+
+/**
+ * @brief Adds `n` to a counter of the calling thread.
+ */
+#define STATS_COUNT(counter, n) (threadStats.counters[counter] += (n))
+
+/**
+ * @brief Counts a block of `n` bytes taken from the allocator.
+ */
+#define STATS_ALLOCATION(n) (STATS_COUNT(COUNT_ALLOCATIONS, 1), STATS_COUNT(COUNT_BYTES_ALLOCATED, (n)))
+
+/**
+ * @brief A point in time on the wall clock and on the CPU clock of the calling thread.
+ */
+typedef struct {
+    double wall;
+    double cpu;
+} StatsMark;
+
+/**
+ * Function: stats_now
  * -------------------
- * @brief Parses a line of text from the CSV file to extract data fields.
- *
- * This function takes a line of text (a row from the CSV file) and extracts the artist, song, year, and sorting values
- * based on the field index. The field values are then stored in the respective output parameters.
+ * @brief Reads the wall clock and the CPU clock of the calling thread.
  *
- * @param line The line of text to be parsed from the CSV file.
- * @param artist A pointer to the character array to store the artist name.
- * @param song A pointer to the character array to store the song name.
- * @param year A pointer to the integer variable to store the year value.
- * @param sorting A pointer to the float variable to store the sorting value.
- * @param options A pointer to the Options struct containing configuration settings.
- *
- */ 
-void parseLine(char* line, char* artist, char* song, int* year, float* sorting, const Options* options) {
-    char* token = strtok(line, ",");
-    int field = 0;
-
-    while (token != NULL) {
-        switch (field) {
-            case 0:
-                strcpy(artist, token);
-                break;
-            case 1:
-                strcpy(song, token);
-                break;
-            case 4:
-                *year = atoi(token);
-                break;
-            case 5:
-                if (strcmp(options->sortBy, "popularity") == 0) {
-                    *sorting = atof(token);
-                }
-                break;
-            case 6:
-                if (strcmp(options->sortBy, "danceability") == 0) {
-                    *sorting = atof(token);
-                }
-                break;
-            case 7:
-                if (strcmp(options->sortBy, "energy") == 0) {
-                    *sorting = atof(token);
-                }
-                break;
-        }
-        field++;
-        token = strtok(NULL, ",");
-    }
+ * @return StatsMark The current time on both clocks, in seconds.
+ */
+StatsMark stats_now() {
+    struct timespec wall, cpu;
+    StatsMark mark;
+
+    clock_gettime(CLOCK_MONOTONIC, &wall);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    mark.wall = wall.tv_sec + wall.tv_nsec / 1e9;
+    mark.cpu = cpu.tv_sec + cpu.tv_nsec / 1e9;
+    return mark;
 }
 
 /**
- * Function: createNode
- * --------------------
- * @brief Creates a new node for the linked list with the provided data.
- *
- * @param artist The artist name to be associated with the new node.
- * @param song The song name to be associated with the new node.
- * @param year The year value to be associated with the new node.
- * @param sorting The sorting value to be associated with the new node.
+ * Function: stats_stage
+ * ---------------------
+ * @brief Charges the time since `mark` to a stage and moves `mark` to now.
  *
- * @return node_t* A pointer to the newly created node.
+ * Stages are timed at their boundaries only, a few clock reads per file or unit, never per row.
  *
- */ 
-node_t* createNode(const char* artist, const char* song, int year, float sorting) {
-    node_t* new_node = emalloc(sizeof(node_t));
-    new_node->artist = emalloc(strlen(artist) + 1);
-    new_node->song = emalloc(strlen(song) + 1);
-    strcpy(new_node->artist, artist);
-    strcpy(new_node->song, song);
-    new_node->year = year;
-    new_node->sorting = sorting;
-    new_node->next = NULL;
-    return new_node;
+ * @return nothing
+ */
+void stats_stage(int stage, StatsMark* mark) {
+    StatsMark now = stats_now();
+    threadStats.wall[stage] += now.wall - mark->wall;
+    threadStats.cpu[stage] += now.cpu - mark->cpu;
+    *mark = now;
 }
 
 /**
- * Function: extractDataFromCSV
- * ----------------------------
- * @brief Extracts data from CSV files and populates a linked list.
- *
- * @param options The `Options` struct containing configuration settings for data extraction.
- * @param list A double pointer to the head of the linked list, which will be populated with the extracted data.
+ * Function: stats_add
+ * -------------------
+ * @brief Adds the stage times and counters of another thread to the calling thread's.
  *
- */ 
-void extractDataFromCSV(Options options, node_t** list) {
-    for (int i = 0; i < options.numFiles; i++) {
-        FILE* file = openFileForReading(options.files[i]);
-        if (file == NULL) {
-            continue;
-        }
-
-        char line[MAX_LINE_LEN];
-        fgets(line, sizeof(line), file);
-
-        while (fgets(line, sizeof(line), file) != NULL) {
-            char artist[100];
-            char song[100];
-            int year;
-            float sorting;
-
-            parseLine(line, artist, song, &year, &sorting, &options);
-            node_t* new_node = createNode(artist, song, year, sorting);
-            *list = add_inorder(*list, new_node);
-        }
-
-        fclose(file);
+ * @return nothing
+ */
+void stats_add(const Stats* other) {
+    for (int s = 0; s < NUM_STAGES; s++) {
+        threadStats.wall[s] += other->wall[s];
+        threadStats.cpu[s] += other->cpu[s];
+    }
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        threadStats.counters[c] += other->counters[c];
     }
-
-    print_next_nodes(*list, options.display, options);
 }
 
 /**
- * @brief The main function and entry point of the program.
+ * Function: stats_report
+ * ----------------------
+ * @brief Writes the stage times and counters of the run as one JSON object.
  *
- * @param argc The number of arguments passed to the program.
- * @param argv The list of arguments passed to the program.
- * @return int 0: No errors; 1: Errors produced.
+ * @param destination "-" for standard error, otherwise the path of the file to write.
+ * @param threads The number of ingest threads that ran.
+ * @param start The time the run started.
  *
+ * @return nothing
  */
-int main(int argc, char* argv[]) {
-    node_t* list = NULL;
-    Options options = parse_arguments(argc, argv);
-    extractDataFromCSV(options, &list);
-    
-    free(options.sortBy);
-    for (int i = 0; i < options.numFiles; i++) {
-        free(options.files[i]);
-    }
-    free(options.files);
+void stats_report(const char* destination, int threads, StatsMark start) {
+    struct timespec cpu;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+    double wall = stats_now().wall - start.wall;
 
-    exit(0);
+    FILE* file = strcmp(destination, "-") == 0 ? stderr : fopen(destination, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open %s for writing.\n", destination);
+        return;
+    }
+    fprintf(file, "{\"tool\":\"music_manager\",\"threads\":%d,\"wall_s\":%.6f,\"cpu_s\":%.6f,\"stages\":{",
+            threads, wall, cpu.tv_sec + cpu.tv_nsec / 1e9);
+    for (int s = 0; s < NUM_STAGES; s++) {
+        fprintf(file, "%s\"%s\":{\"wall_s\":%.6f,\"cpu_s\":%.6f}", s > 0 ? "," : "", STAGE_NAMES[s],
+                threadStats.wall[s], threadStats.cpu[s]);
+    }
+    fprintf(file, "},\"counters\":{");
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        fprintf(file, "%s\"%s\":%llu", c > 0 ? "," : "", COUNTER_NAMES[c], threadStats.counters[c]);
+    }
+    fprintf(file, "}}\n");
+    if (file != stderr) {
+        fclose(file);
+    }
 }
 
- 
-//emalloccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccc
-/** @file music_manager.c
- *  @brief A small program to analyze songs data.
- *  @author Mike Z.
- *  @author Felipe R.
- *  @author Hausi M.
- *  @author Jose O.
- *  @author Victoria L.
- *  @author Dorsa Peikani
- *
+/**
+ * @brief The size of the output buffer. Records are formatted into it and written out when it fills up.
  */
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include "list.h"
-#include "list.c"
+#define OUTPUT_BUFFER_SIZE (1 << 16)
 
-#define MAX_LINE_LEN 180
- 
 /**
- * @brief An struct that encapsulates program arguments such as sorting, display preferences, file names, and numerical parameters like energy and danceability.
+ * @brief A destination for the output CSV that collects formatted bytes and writes them in large blocks.
+ *
+ * A `deadline` other than 0 is the time on the stats_now wall clock past which no more bytes are written.
  */
 typedef struct {
-    char* sortBy;
-    int display;
-    char** files;
-    int numFiles;
-    float energy;          
-    float danceability;    
-} Options;
+    int fd;
+    size_t used;
+    int failed;
+    double deadline;
+    char data[OUTPUT_BUFFER_SIZE];
+} OutputBuffer;
 
 /**
- * Function: parse_arguments
- * -------------------------
- * @brief Parses command-line arguments and populates an Options struct with the parsed values.
+ * Function: output_flush
+ * ----------------------
+ * @brief Writes out everything buffered so far.
  *
- * @param argc The number of command-line arguments.
- * @param argv An array of strings containing the command-line arguments.
- *
- * @return Options The Options struct populated with the parsed values.
+ * @return nothing
  */
-Options parse_arguments(int argc, char* argv[]) {
-    Options options;
-    options.sortBy = NULL;
-    options.display = 0;
-    options.files = NULL;
-    options.numFiles = 0;
-    options.energy = 0.0;          
-    options.danceability = 0.0;      
-
-    for (int i = 1; i < argc; i++) {
-        if (strncmp(argv[i], "--sortBy=", 9) == 0) {
-            options.sortBy = strdup(argv[i] + 9);
-        } else if (strncmp(argv[i], "--display=", 10) == 0) {
-            options.display = atoi(argv[i] + 10);
-        } else if (strncmp(argv[i], "--files=", 8) == 0) {
-            char* filesArg = strdup(argv[i] + 8);
-            char* token = strtok(filesArg, ",");
-            while (token != NULL) {
-                options.files = realloc(options.files, (options.numFiles + 1) * sizeof(char*));
-                options.files[options.numFiles] = strdup(token);
-                options.numFiles++;
-                token = strtok(NULL, ",");
+void output_flush(OutputBuffer* out) {
+    size_t done = 0;
+
+    while (done < out->used && !out->failed) {
+        if (out->deadline > 0 && stats_now().wall > out->deadline) {
+            fprintf(stderr, "Failed to write the output in time, dropping the rest of it.\n");
+            out->failed = 1;
+            break;
+        }
+        ssize_t n = write(out->fd, out->data + done, out->used - done);
+        if (n > 0) {
+            STATS_COUNT(COUNT_BYTES_WRITTEN, (unsigned long long)n);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
             }
-            free(filesArg);
-        } else if (strncmp(argv[i], "--energy=", 9) == 0) {
-            options.energy = atof(argv[i] + 9);
-        } else if (strncmp(argv[i], "--danceability=", 15) == 0) {
-            options.danceability = atof(argv[i] + 15);
+            fprintf(stderr, "Failed to write the output: %s\n", strerror(errno));
+            out->failed = 1;
+        } else {
+            done += (size_t)n;
         }
     }
-
-    return options;
+    out->used = 0;
 }
 
 /**
- * Function: print_next_nodes
- * --------------------------
- * @brief Prints a specified number of next nodes from the linked list and writes the data to a CSV file.
+ * Function: output_write
+ * ----------------------
+ * @brief Appends bytes to the output buffer, flushing it first if they do not fit.
  *
- * @param list A pointer to the head of the linked list.
- * @param display The number of nodes to display and write to the CSV file.
- * @param options The Options struct containing configuration settings.
+ * @return nothing
  */
-void print_next_nodes(node_t* list, int display, Options options) {
-    node_t* current = list;
-    int count = 0;
-
-    FILE* output_file = fopen("output.csv", "w");
-    if (output_file == NULL) {
-        printf("Failed to open output.csv for writing.\n");
-        return;
-    }
-    fprintf(output_file, "artist,song,year,%s\n", options.sortBy);
-    while (current != NULL && count < display) {
-        fprintf(output_file, "%s,%s,%d,%g\n", current->artist, current->song, current->year, current->sorting);
-        current = current->next;
-        count++;
-    }
-    free(options.sortBy);
-    for (int i = 0; i < options.numFiles; i++) {
-        free(options.files[i]);
+void output_write(OutputBuffer* out, const char* bytes, size_t len) {
+    while (len > 0) {
+        if (out->used == OUTPUT_BUFFER_SIZE) {
+            output_flush(out);
+        }
+        size_t n = OUTPUT_BUFFER_SIZE - out->used;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(out->data + out->used, bytes, n);
+        out->used += n;
+        bytes += n;
+        len -= n;
     }
-    free(options.files);
-
-    fclose(output_file);
 }
 
 /**
- * Function: openFileForReading
- * ---------------------------
- * @brief Opens a file for reading and returns a pointer to the file stream.
+ * Function: output_reserve
+ * ------------------------
+ * @brief Makes sure at least `len` bytes (at most OUTPUT_BUFFER_SIZE) can be appended without a flush.
  *
- * @param filename The name of the file to be opened for reading.
- *
- * @return FILE* A pointer to the `FILE` structure representing the file stream if the file was opened successfully,
- *         or NULL if the file could not be opened.
+ * @return char* Where the next bytes go. Advance `used` by the number of bytes actually written.
+ */
+char* output_reserve(OutputBuffer* out, size_t len) {
+    if (OUTPUT_BUFFER_SIZE - out->used < len) {
+        output_flush(out);
+    }
+    return out->data + out->used;
+}
+
+/**
+ * Function: output_int
+ * --------------------
+ * @brief Appends an integer in decimal, as `%d` would.
  *
- */ 
-FILE* openFileForReading(const char* filename) {
-    FILE* file = fopen(filename, "r");
-    if (file == NULL) {
-        printf("Failed to open file %s for reading.\n", filename);
+ * @return nothing
+ */
+void output_int(OutputBuffer* out, int value) {
+    char digits[12];
+    int n = 0;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    char* p = output_reserve(out, sizeof(digits));
+
+    do {
+        digits[n++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) {
+        *p++ = '-';
+        out->used++;
+    }
+    while (n > 0) {
+        *p++ = digits[--n];
+        out->used++;
     }
-    return file;
 }
 
-void parseLine(char* line, char** artist, char** song, int* year, float* sorting, const Options* options) {
-    char* token = strtok(line, ",");
+/**
+ * Function: output_float
+ * ----------------------
+ * @brief Appends a float the way `%g` prints it, without going through printf.
+ *
+ * A float is M * 2^E with a 24-bit M. For -44 <= E <= 100 that value is exactly N / 10^k for a 128-bit N, so
+ * its decimal digits are exact and can be rounded to six significant digits (ties to even) just like printf
+ * does. Other values, infinities and NaN fall back to snprintf.
+ *
+ * @return nothing
+ */
+void output_float(OutputBuffer* out, float value) {
+    char* p = output_reserve(out, 32);
+
+#if defined(__SIZEOF_INT128__)
+    int binaryExponent;
+    double fraction = frexp(fabs((double)value), &binaryExponent);
+    int e = binaryExponent - 24;
+
+    if (isfinite(value) && e >= -44 && e <= 100) {
+        unsigned __int128 n = (unsigned __int128)(unsigned long)(fraction * (1 << 24));
+        int k = 0;
+        char exact[40];
+        int len = 0;
+
+        if (e >= 0) {
+            n <<= e;
+        } else {
+            for (k = 0; k < -e; k++) {
+                n *= 5;
+            }
+        }
+        do {
+            exact[len++] = (char)('0' + (int)(n % 10));
+            n /= 10;
+        } while (n != 0);
+        for (int i = 0; i < len / 2; i++) {
+            char t = exact[i];
+            exact[i] = exact[len - 1 - i];
+            exact[len - 1 - i] = t;
+        }
+
+        /* exact[] holds the digits of value * 10^k; keep six of them, rounded, in `q`. */
+        int decimalExponent = len - 1 - k;
+        long q = 0;
+        for (int i = 0; i < 6; i++) {
+            q = q * 10 + (i < len ? exact[i] - '0' : 0);
+        }
+        if (len > 6) {
+            int up = exact[6] > '5';
+            if (exact[6] == '5') {
+                up = q % 2 == 1;
+                for (int i = 7; i < len; i++) {
+                    if (exact[i] != '0') {
+                        up = 1;
+                        break;
+                    }
+                }
+            }
+            if (up && ++q == 1000000) {
+                q = 100000;
+                decimalExponent++;
+            }
+        }
+        if (value == 0) {
+            decimalExponent = 0;
+        }
+
+        char digits[6];
+        int significant = 6;
+        for (int i = 5; i >= 0; i--) {
+            digits[i] = (char)('0' + q % 10);
+            q /= 10;
+        }
+        while (significant > 1 && digits[significant - 1] == '0') {
+            significant--;
+        }
+
+        char* start = p;
+        if (signbit(value)) {
+            *p++ = '-';
+        }
+        if (decimalExponent < -4 || decimalExponent >= 6) {
+            *p++ = digits[0];
+            if (significant > 1) {
+                *p++ = '.';
+                memcpy(p, digits + 1, significant - 1);
+                p += significant - 1;
+            }
+            int magnitude = decimalExponent < 0 ? -decimalExponent : decimalExponent;
+            *p++ = 'e';
+            *p++ = decimalExponent < 0 ? '-' : '+';
+            if (magnitude >= 100) {
+                *p++ = (char)('0' + magnitude / 100);
+            }
+            *p++ = (char)('0' + magnitude / 10 % 10);
+            *p++ = (char)('0' + magnitude % 10);
+        } else if (decimalExponent < 0) {
+            *p++ = '0';
+            *p++ = '.';
+            for (int i = 0; i < -decimalExponent - 1; i++) {
+                *p++ = '0';
+            }
+            memcpy(p, digits, significant);
+            p += significant;
+        } else {
+            memcpy(p, digits, decimalExponent + 1);
+            p += decimalExponent + 1;
+            if (significant > decimalExponent + 1) {
+                *p++ = '.';
+                memcpy(p, digits + decimalExponent + 1, significant - decimalExponent - 1);
+                p += significant - decimalExponent - 1;
+            }
+        }
+        out->used += (size_t)(p - start);
+        return;
+    }
+#endif
+    out->used += (size_t)snprintf(p, 32, "%g", value);
+}
+
+/**
+ * Function: output_attach
+ * -----------------------
+ * @brief Starts a buffer that writes to an open descriptor. output_close closes it unless it is standard output.
+ *
+ * @return OutputBuffer* The buffer to write through.
+ */
+OutputBuffer* output_attach(int fd) {
+    OutputBuffer* out = emalloc(sizeof(OutputBuffer));
+    STATS_ALLOCATION(sizeof(OutputBuffer));
+    out->fd = fd;
+    out->used = 0;
+    out->failed = 0;
+    out->deadline = 0;
+    return out;
+}
+
+/**
+ * Function: output_open
+ * ---------------------
+ * @brief Opens the destination of the output CSV. A path of "-" writes to standard output.
+ *
+ * @return OutputBuffer* The buffer to write through, or NULL if the destination could not be opened.
+ */
+OutputBuffer* output_open(const char* path) {
+    int fd = STDOUT_FILENO;
+
+    if (strcmp(path, "-") != 0) {
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            fprintf(stderr, "Failed to open %s for writing.\n", path);
+            return NULL;
+        }
+    }
+    return output_attach(fd);
+}
+
+/**
+ * Function: output_close
+ * ----------------------
+ * @brief Flushes the buffer, closes its destination and releases it.
+ *
+ * @return nothing
+ */
+void output_close(OutputBuffer* out) {
+    output_flush(out);
+    if (out->fd != STDOUT_FILENO) {
+        close(out->fd);
+    }
+    free(out);
+}
+
+/**
+ * Function: write_nodes
+ * ---------------------
+ * @brief Formats the CSV header and up to `display` nodes of the list into an OutputBuffer.
+ *
+ * @param out The buffer to write to.
+ * @param list A pointer to the head of the linked list.
+ * @param display The number of nodes to write.
+ * @param column The name of the column whose value follows the year, the sorting value of the nodes, or NULL
+ * to write only artist, song and year.
+ * @return nothing
+ */
+void write_nodes(OutputBuffer* out, node_t* list, int display, const char* column) {
+    node_t* current = list;
+    int count = 0;
+
+    output_write(out, "artist,song,year", 16);
+    if (column != NULL) {
+        output_write(out, ",", 1);
+        output_write(out, column, strlen(column));
+    }
+    output_write(out, "\n", 1);
+    while (current != NULL && count < display) {
+        output_write(out, current->artist, strlen(current->artist));
+        output_write(out, ",", 1);
+        output_write(out, current->song, strlen(current->song));
+        output_write(out, ",", 1);
+        output_int(out, current->year);
+        if (column != NULL) {
+            output_write(out, ",", 1);
+            output_float(out, current->sorting);
+        }
+        output_write(out, "\n", 1);
+        current = current->next;
+        count++;
+    }
+}
+
+/**
+ * Function: print_next_nodes
+ * --------------------------
+ * @brief Prints a specified number of next nodes from the linked list and writes the data to a CSV file.
+ *
+ * The records are formatted into an OutputBuffer, which writes them to the --output destination (output.csv
+ * by default, "-" for standard output) in large blocks.
+ *
+ * @param list A pointer to the head of the linked list.
+ * @param display The number of nodes to display and write to the CSV file.
+ * @param options The Options struct containing configuration settings.
+ * @param column The name of the last column, as for write_nodes.
+ * @return nothing
+ */
+void print_next_nodes(node_t* list, int display, Options options, const char* column) {
+    OutputBuffer* out = output_open(options.output != NULL ? options.output : "output.csv");
+    if (out == NULL) {
+        return;
+    }
+    write_nodes(out, list, display, column);
+    output_close(out);
+}
+
+/**
+ * @brief A read-only view of bytes inside a mapped file. It is not NUL-terminated.
+ */
+typedef struct {
+    const char* data;
+    size_t len;
+} StrView;
+
+/**
+ * @brief A CSV file mapped into memory for reading.
+ */
+typedef struct {
+    const char* data;
+    size_t size;
+} MappedFile;
+
+/**
+ * Function: mapFileForReading
+ * ---------------------------
+ * @brief Maps a whole file into memory for reading.
+ *
+ * @param filename The name of the file to be mapped.
+ * @param mapped A pointer to store the mapping. An empty file is mapped as a NULL pointer of size 0.
+ *
+ * @return int 1 if the file was mapped successfully, 0 if it could not be opened or mapped.
+ *
+ */
+int mapFileForReading(const char* filename, MappedFile* mapped) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open file %s for reading.\n", filename);
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Failed to open file %s for reading.\n", filename);
+        close(fd);
+        return 0;
+    }
+
+    mapped->data = NULL;
+    mapped->size = (size_t)st.st_size;
+    STATS_COUNT(COUNT_BYTES_READ, mapped->size);
+    if (mapped->size > 0) {
+        void* data = mmap(NULL, mapped->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "Failed to map file %s for reading.\n", filename);
+            close(fd);
+            return 0;
+        }
+        madvise(data, mapped->size, MADV_SEQUENTIAL);
+        mapped->data = data;
+    }
+    close(fd);
+    return 1;
+}
+
+/**
+ * Function: unmapFile
+ * -------------------
+ * @brief Releases a mapping made by mapFileForReading.
+ *
+ * @return nothing
+ */
+void unmapFile(MappedFile* mapped) {
+    if (mapped->data != NULL) {
+        munmap((void*)mapped->data, mapped->size);
+    }
+    mapped->data = NULL;
+    mapped->size = 0;
+}
+
+/**
+ * Function: nextLine
+ * ------------------
+ * @brief Cuts the next line out of a mapped file, without its line terminator.
+ *
+ * @param cursor A pointer to the current position, advanced past the line.
+ * @param end The end of the mapped bytes.
+ * @param line A pointer to store the line.
+ *
+ * @return int 1 if a line was found, 0 at the end of the file.
+ */
+int nextLine(const char** cursor, const char* end, StrView* line) {
+    const char* start = *cursor;
+    if (start >= end) {
+        return 0;
+    }
+
+    const char* newline = memchr(start, '\n', (size_t)(end - start));
+    const char* stop = newline != NULL ? newline : end;
+    *cursor = newline != NULL ? newline + 1 : end;
+
+    if (stop > start && stop[-1] == '\r') {
+        stop--;
+    }
+    line->data = start;
+    line->len = (size_t)(stop - start);
+    return 1;
+}
+
+/**
+ * Function: viewToDouble
+ * ----------------------
+ * @brief Converts a numeric field to a double with atof. Fields too long to be a number convert to 0.
+ *
+ * @return double The value of the field.
+ */
+double viewToDouble(StrView field) {
+    char buffer[64];
+    STATS_COUNT(COUNT_NUMBERS_SLOW_PATH, 1);
+    if (field.len >= sizeof(buffer)) {
+        return 0.0;
+    }
+    memcpy(buffer, field.data, field.len);
+    buffer[field.len] = '\0';
+    return atof(buffer);
+}
+
+/**
+ * @brief The powers of ten that are exactly representable as a double.
+ */
+const double EXACT_POWERS_OF_TEN[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/**
+ * Function: parseDoubleField
+ * --------------------------
+ * @brief Converts a numeric field to a double without copying it, giving exactly what atof gives.
+ *
+ * Plain decimals such as `0.734`, `-5.2`, `87` or `1.5e-3` with at most 19 significant digits take a fast path:
+ * the digits are read into an integer that is then scaled by one exact power of ten. When the integer fits in
+ * 53 bits and the power is at most 10^22, both operands are exact and the single multiply or divide rounds
+ * correctly, so the result is the same double strtod would produce. Anything else goes through
+ * viewToDouble.
+ *
+ * @return double The value of the field.
+ */
+double parseDoubleField(StrView field) {
+    const char* p = field.data;
+    const char* end = field.data + field.len;
+    unsigned long long mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    int negative = 0;
+
+    STATS_COUNT(COUNT_NUMBERS_PARSED, 1);
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    const char* first = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (mantissa != 0 || *p != '0') {
+            digits++;
+        }
+        mantissa = mantissa * 10 + (unsigned long long)(*p - '0');
+        p++;
+    }
+    int intDigits = (int)(p - first);
+    if (p < end && *p == '.') {
+        p++;
+        const char* fraction = p;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (mantissa != 0 || *p != '0') {
+                digits++;
+            }
+            mantissa = mantissa * 10 + (unsigned long long)(*p - '0');
+            p++;
+        }
+        exponent = -(int)(p - fraction);
+        intDigits += (int)(p - fraction);
+    }
+    if (intDigits == 0 || digits > 19) {
+        return viewToDouble(field);
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        int expNegative = 0;
+        int value = 0;
+        if (p < end && (*p == '-' || *p == '+')) {
+            expNegative = *p == '-';
+            p++;
+        }
+        const char* expDigits = p;
+        while (p < end && *p >= '0' && *p <= '9' && value < 1000) {
+            value = value * 10 + (*p - '0');
+            p++;
+        }
+        if (p == expDigits) {
+            return viewToDouble(field);
+        }
+        exponent += expNegative ? -value : value;
+    }
+    if (p != end || mantissa > (1ULL << 53) || exponent < -22 || exponent > 22) {
+        return viewToDouble(field);
+    }
+
+    double value = (double)mantissa;
+    if (exponent < 0) {
+        value /= EXACT_POWERS_OF_TEN[-exponent];
+    } else {
+        value *= EXACT_POWERS_OF_TEN[exponent];
+    }
+    return negative ? -value : value;
+}
+
+/**
+ * Function: parseIntField
+ * -----------------------
+ * @brief Converts an integer field without copying it, reading it the way atoi does.
+ *
+ * Leading blanks and a sign are skipped and digits are read up to the first other character.
+ *
+ * @return int The value of the field.
+ */
+int parseIntField(StrView field) {
+    const char* p = field.data;
+    const char* end = field.data + field.len;
+    int negative = 0;
+    unsigned int value = 0;
+
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (unsigned int)(*p - '0');
+        p++;
+    }
+    return negative ? -(int)value : (int)value;
+}
+
+/**
+ * @brief The size of a regular arena block. Larger requests get a block of their own.
+ */
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+/**
+ * @brief The alignment of every arena allocation, enough for a node_t.
+ */
+#define ARENA_ALIGN sizeof(void*)
+
+/**
+ * @brief A block of arena memory. Blocks are chained from the newest to the oldest.
+ */
+typedef struct ArenaBlock {
+    struct ArenaBlock* prev;
+    size_t used;
+    size_t size;
+    char data[];
+} ArenaBlock;
+
+/**
+ * @brief A bump allocator that owns all song records and their strings for a run.
+ */
+typedef struct {
+    ArenaBlock* head;
+} Arena;
+
+/**
+ * Function: arena_alloc
+ * ---------------------
+ * @brief Allocates `size` bytes from the arena, starting a new block when the current one is full.
+ *
+ * @param arena A pointer to the arena.
+ * @param size The number of bytes needed.
+ *
+ * @return void* A pointer to the allocated bytes. It stays valid until the arena is freed.
+ */
+void* arena_alloc(Arena* arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    STATS_COUNT(COUNT_ARENA_ALLOCATIONS, 1);
+
+    if (arena->head == NULL || arena->head->size - arena->head->used < size) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        ArenaBlock* block = emalloc(sizeof(ArenaBlock) + block_size);
+        STATS_ALLOCATION(sizeof(ArenaBlock) + block_size);
+        block->prev = arena->head;
+        block->used = 0;
+        block->size = block_size;
+        arena->head = block;
+    }
+
+    void* p = arena->head->data + arena->head->used;
+    arena->head->used += size;
+    return p;
+}
+
+/**
+ * Function: arena_strndup
+ * -----------------------
+ * @brief Copies `len` bytes of a string into the arena and terminates the copy.
+ *
+ * @return char* The NUL-terminated copy.
+ */
+char* arena_strndup(Arena* arena, const char* s, size_t len) {
+    char* copy = arena_alloc(arena, len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+/**
+ * Function: arena_free
+ * --------------------
+ * @brief Releases every block of the arena in one go.
+ *
+ * @return nothing
+ */
+void arena_free(Arena* arena) {
+    while (arena->head != NULL) {
+        ArenaBlock* prev = arena->head->prev;
+        free(arena->head);
+        arena->head = prev;
+    }
+}
+
+/**
+ * @brief The maximum number of numeric columns a run can read from each row.
+ */
+#define MAX_VALUE_COLUMNS 16
+
+/**
+ * Function: erealloc
+ * ------------------
+ * @brief Resizes a block of memory, exiting the program if it cannot.
+ *
+ * @return void* A pointer to the resized block.
+ */
+void* erealloc(void* p, size_t n) {
+    void* q = realloc(p, n);
+    STATS_ALLOCATION(n);
+    if (q == NULL && n > 0) {
+        fprintf(stderr, "realloc of %zu bytes failed\n", n);
+        exit(1);
+    }
+    return q;
+}
+
+/**
+ * @brief The songs of a range of CSV rows, stored column by column.
+ *
+ * Every column is a contiguous array indexed by row. The artist and song columns are offsets into `text`, the
+ * mapped file the rows come from, so a row costs a few bytes per column and no string is copied until it is
+ * printed. The table does not own `text`. `values[v]` holds value column `v` of the run's ValueColumns.
+ */
+typedef struct {
+    const char* text;
+    size_t rows;
+    size_t capacity;
+    size_t* artist_off;
+    size_t* song_off;
+    unsigned int* artist_len;
+    unsigned int* song_len;
+    int* year;
+    int numValues;
+    float* values[MAX_VALUE_COLUMNS];
+} SongTable;
+
+/**
+ * Function: song_table_reserve
+ * ----------------------------
+ * @brief Makes room for at least `capacity` rows in every column.
+ *
+ * @return nothing
+ */
+void song_table_reserve(SongTable* table, size_t capacity) {
+    if (capacity <= table->capacity) {
+        return;
+    }
+    table->artist_off = erealloc(table->artist_off, capacity * sizeof(size_t));
+    table->song_off = erealloc(table->song_off, capacity * sizeof(size_t));
+    table->artist_len = erealloc(table->artist_len, capacity * sizeof(unsigned int));
+    table->song_len = erealloc(table->song_len, capacity * sizeof(unsigned int));
+    table->year = erealloc(table->year, capacity * sizeof(int));
+    for (int v = 0; v < table->numValues; v++) {
+        table->values[v] = erealloc(table->values[v], capacity * sizeof(float));
+    }
+    table->capacity = capacity;
+}
+
+/**
+ * Function: song_table_free
+ * -------------------------
+ * @brief Releases the columns of a table.
+ *
+ * @return nothing
+ */
+void song_table_free(SongTable* table) {
+    free(table->artist_off);
+    free(table->song_off);
+    free(table->artist_len);
+    free(table->song_len);
+    free(table->year);
+    for (int v = 0; v < table->numValues; v++) {
+        free(table->values[v]);
+    }
+    memset(table, 0, sizeof(SongTable));
+}
+
+/**
+ * Function: scanFieldBreak
+ * ------------------------
+ * @brief Finds the first comma or double quote at or after `p`.
+ *
+ * Compares 32 bytes at a time with AVX2 or 16 bytes at a time with SSE2 when the compiler targets them, and
+ * finishes the tail of the line byte by byte.
+ *
+ * @param p The position to start scanning from.
+ * @param end The end of the line.
+ *
+ * @return const char* The position of the comma or quote, or `end` if there is none.
+ */
+const char* scanFieldBreak(const char* p, const char* end) {
+#if defined(__AVX2__)
+    const __m256i commas = _mm256_set1_epi8(',');
+    const __m256i quotes = _mm256_set1_epi8('"');
+    while (end - p >= 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)p);
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(bytes, commas), _mm256_cmpeq_epi8(bytes, quotes)));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+#elif defined(__SSE2__)
+    const __m128i commas = _mm_set1_epi8(',');
+    const __m128i quotes = _mm_set1_epi8('"');
+    while (end - p >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)p);
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, commas), _mm_cmpeq_epi8(bytes, quotes)));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != ',' && *p != '"') {
+        p++;
+    }
+    return p;
+}
+
+/**
+ * Function: splitField
+ * --------------------
+ * @brief Cuts the next field out of a CSV line.
+ *
+ * A field that starts with a double quote runs to its closing quote, so commas inside it do not split it;
+ * a doubled quote inside it is an escaped quote. The view keeps the quotes, which lets the field be written
+ * back out as valid CSV unchanged.
+ *
+ * @param cursor The start of the field.
+ * @param end The end of the line.
+ * @param field A pointer to store the field.
+ *
+ * @return const char* The comma that ends the field, or `end` if it is the last field of the line.
+ */
+const char* splitField(const char* cursor, const char* end, StrView* field) {
+    const char* p = cursor;
+
+    STATS_COUNT(COUNT_FIELDS_SPLIT, 1);
+    if (p < end && *p == '"') {
+        p++;
+        for (;;) {
+            const char* quote = memchr(p, '"', (size_t)(end - p));
+            if (quote == NULL) {
+                p = end;
+                break;
+            }
+            p = quote + 1;
+            if (p < end && *p == '"') {
+                p++;
+            } else {
+                break;
+            }
+        }
+    }
+    for (;;) {
+        p = scanFieldBreak(p, end);
+        if (p < end && *p == '"') {
+            p++;
+        } else {
+            break;
+        }
+    }
+
+    field->data = cursor;
+    field->len = (size_t)(p - cursor);
+    return p;
+}
+
+/**
+ * @brief The roles a CSV column can play in a run, besides holding a value column (a role of 0 or more).
+ */
+enum {
+    FIELD_SKIP = -1,
+    FIELD_ARTIST = -2,
+    FIELD_SONG = -3,
+    FIELD_YEAR = -4
+};
+
+/**
+ * @brief The numeric columns a run needs from each row, by header name, and the range each value must fall in.
+ *
+ * The numeric keys of --sortBy take the first slots, in the order they are listed. Filters add their column
+ * here too (or reuse the slot of a column already requested) and narrow its range; rows with a value outside
+ * the range of any slot are dropped by the row parser. An unfiltered slot accepts every value.
+ */
+typedef struct {
+    const char* names[MAX_VALUE_COLUMNS];
+    float min[MAX_VALUE_COLUMNS];
+    float max[MAX_VALUE_COLUMNS];
+    int count;
+} ValueColumns;
+
+/**
+ * Function: findValueColumn
+ * -------------------------
+ * @brief Finds the slot of a value column.
+ *
+ * @return int The slot of the column, or -1 if the run does not read it.
+ */
+int findValueColumn(const ValueColumns* values, const char* name) {
+    for (int v = 0; v < values->count; v++) {
+        if (strcmp(values->names[v], name) == 0) {
+            return v;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Function: requestValueColumn
+ * ----------------------------
+ * @brief Finds the slot of a value column, adding the column if the run does not read it yet.
+ *
+ * @return int The slot of the column, or -1 if no slot is left.
+ */
+int requestValueColumn(ValueColumns* values, const char* name) {
+    int slot = findValueColumn(values, name);
+    if (slot >= 0) {
+        return slot;
+    }
+    if (values->count == MAX_VALUE_COLUMNS) {
+        return -1;
+    }
+    values->names[values->count] = name;
+    values->min[values->count] = -INFINITY;
+    values->max[values->count] = INFINITY;
+    return values->count++;
+}
+
+/**
+ * Function: addRangeFilter
+ * ------------------------
+ * @brief Keeps only rows whose value in column `name` lies within [min, max].
+ *
+ * @return nothing
+ */
+void addRangeFilter(ValueColumns* values, const char* name, float min, float max) {
+    int v = requestValueColumn(values, name);
+    if (v < 0) {
+        fprintf(stderr, "Too many columns, ignoring the filter on %s.\n", name);
+        return;
+    }
+    if (min > values->min[v]) {
+        values->min[v] = min;
+    }
+    if (max < values->max[v]) {
+        values->max[v] = max;
+    }
+}
+
+/**
+ * Function: valueRejected
+ * -----------------------
+ * @brief Tells whether a value falls outside the range of its slot.
+ *
+ * @return int 1 if the row holding the value must be dropped, 0 otherwise.
+ */
+int valueRejected(const ValueColumns* values, int v, float value) {
+    return value < values->min[v] || value > values->max[v];
+}
+
+/**
+ * @brief The most keys a --sortBy spec can list.
+ */
+#define MAX_SORT_KEYS 8
+
+/**
+ * @brief A --sortBy spec: the keys songs are ordered by, most significant first, and the direction of each.
+ *
+ * A spec is a comma-separated list of `column`, `column:asc` or `column:desc`, for example
+ * "energy:desc,year:asc,artist". Numeric columns, year included, sort descending unless told otherwise, as a
+ * plain --sortBy always has; artist and song sort ascending by their bytes. Songs equal on every key keep
+ * their input order. `roles[k]` is FIELD_ARTIST, FIELD_SONG, FIELD_YEAR or the value slot of key `k` once
+ * the spec is resolved. `shown` is the first key that is not artist, song or year, whose value the output CSV
+ * carries in its last column, or -1 if there is none.
+ */
+typedef struct {
+    int numKeys;
+    char* names[MAX_SORT_KEYS];
+    int descending[MAX_SORT_KEYS];
+    int roles[MAX_SORT_KEYS];
+    int shown;
+} SortSpec;
+
+/**
+ * Function: sort_spec_free
+ * ------------------------
+ * @brief Releases the key names of a spec.
+ *
+ * @return nothing
+ */
+void sort_spec_free(SortSpec* spec) {
+    for (int k = 0; k < spec->numKeys; k++) {
+        free(spec->names[k]);
+    }
+    spec->numKeys = 0;
+}
+
+/**
+ * Function: sort_spec_parse
+ * -------------------------
+ * @brief Parses the text of a --sortBy option into a spec.
+ *
+ * @return int 1 if the text is a valid spec, 0 otherwise. An invalid spec holds no keys.
+ */
+int sort_spec_parse(const char* text, SortSpec* spec) {
+    const char* cursor = text;
+
+    memset(spec, 0, sizeof(SortSpec));
+    spec->shown = -1;
+    for (;;) {
+        const char* comma = strchr(cursor, ',');
+        size_t len = comma != NULL ? (size_t)(comma - cursor) : strlen(cursor);
+        const char* colon = memchr(cursor, ':', len);
+        size_t nameLen = colon != NULL ? (size_t)(colon - cursor) : len;
+
+        if (nameLen == 0 || spec->numKeys == MAX_SORT_KEYS) {
+            break;
+        }
+        int k = spec->numKeys++;
+        spec->names[k] = strndup(cursor, nameLen);
+        int isText = strcmp(spec->names[k], "artist") == 0 || strcmp(spec->names[k], "song") == 0;
+        int isYear = strcmp(spec->names[k], "year") == 0;
+        spec->descending[k] = !isText;
+        if (colon != NULL) {
+            const char* direction = colon + 1;
+            size_t directionLen = len - nameLen - 1;
+            if (directionLen == 3 && strncmp(direction, "asc", 3) == 0) {
+                spec->descending[k] = 0;
+            } else if (directionLen == 4 && strncmp(direction, "desc", 4) == 0) {
+                spec->descending[k] = 1;
+            } else {
+                break;
+            }
+        }
+        if (!isText && !isYear && spec->shown < 0) {
+            spec->shown = k;
+        }
+        if (comma == NULL) {
+            return 1;
+        }
+        cursor = comma + 1;
+    }
+
+    sort_spec_free(spec);
+    spec->shown = -1;
+    return 0;
+}
+
+/**
+ * Function: sort_spec_resolve
+ * ---------------------------
+ * @brief Finds the role of every key of a spec among the columns of a run.
+ *
+ * @param spec The spec to resolve.
+ * @param values The value columns of the run.
+ * @param request 1 to add numeric keys the run does not read yet to `values`, 0 to only look them up.
+ *
+ * @return int The first key that could not be found or added, or -1 if every key was.
+ */
+int sort_spec_resolve(SortSpec* spec, ValueColumns* values, int request) {
+    for (int k = 0; k < spec->numKeys; k++) {
+        const char* name = spec->names[k];
+        if (strcmp(name, "artist") == 0) {
+            spec->roles[k] = FIELD_ARTIST;
+        } else if (strcmp(name, "song") == 0) {
+            spec->roles[k] = FIELD_SONG;
+        } else if (strcmp(name, "year") == 0) {
+            spec->roles[k] = FIELD_YEAR;
+        } else {
+            spec->roles[k] = request ? requestValueColumn(values, name) : findValueColumn(values, name);
+            if (spec->roles[k] < 0) {
+                return k;
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * Function: sort_spec_column
+ * --------------------------
+ * @brief Returns the name of the column the output CSV ends with for a spec.
+ *
+ * @return const char* The name of the shown key, or NULL if the spec only sorts by artist, song and year.
+ */
+const char* sort_spec_column(const SortSpec* spec) {
+    return spec->shown >= 0 ? spec->names[spec->shown] : NULL;
+}
+
+/**
+ * @brief The layout of one CSV file, resolved from its header line once before any row is parsed.
+ *
+ * `roles[i]` tells the row parser what to do with field `i`; fields from `numFields` on are never looked at.
+ */
+typedef struct {
+    int numFields;
+    int* roles;
+} Schema;
+
+/**
+ * Function: fieldNameEquals
+ * -------------------------
+ * @brief Compares a header field with a column name, ignoring surrounding quotes and blanks.
+ *
+ * @return int 1 if they are equal, 0 otherwise.
+ */
+int fieldNameEquals(StrView field, const char* name) {
+    while (field.len > 0 && (field.data[0] == ' ' || field.data[0] == '"')) {
+        field.data++;
+        field.len--;
+    }
+    while (field.len > 0 && (field.data[field.len - 1] == ' ' || field.data[field.len - 1] == '"')) {
+        field.len--;
+    }
+    return strlen(name) == field.len && memcmp(field.data, name, field.len) == 0;
+}
+
+/**
+ * Function: resolveSchema
+ * -----------------------
+ * @brief Finds the artist, song and year columns and the requested value columns in a header line.
+ *
+ * @param header The header line of the CSV file.
+ * @param values The numeric columns the run needs.
+ * @param filename The name of the CSV file, for error messages.
+ * @param schema A pointer to store the resolved layout.
+ *
+ * @return int 1 if every column was found, 0 otherwise. Missing columns are reported.
+ */
+int resolveSchema(StrView header, const ValueColumns* values, const char* filename, Schema* schema) {
+    const char* cursor = header.data;
+    const char* end = header.data + header.len;
+    int found[MAX_VALUE_COLUMNS] = { 0 };
+    int artist = 0, song = 0, year = 0;
+    int numColumns = 0;
+
+    schema->numFields = 0;
+    schema->roles = NULL;
+    for (;;) {
+        StrView name;
+        const char* comma = splitField(cursor, end, &name);
+        int role = FIELD_SKIP;
+
+        if (fieldNameEquals(name, "artist") && !artist) {
+            role = FIELD_ARTIST;
+            artist = 1;
+        } else if (fieldNameEquals(name, "song") && !song) {
+            role = FIELD_SONG;
+            song = 1;
+        } else if (fieldNameEquals(name, "year") && !year) {
+            role = FIELD_YEAR;
+            year = 1;
+        } else {
+            for (int v = 0; v < values->count; v++) {
+                if (!found[v] && fieldNameEquals(name, values->names[v])) {
+                    role = v;
+                    found[v] = 1;
+                    break;
+                }
+            }
+        }
+
+        schema->roles = erealloc(schema->roles, (numColumns + 1) * sizeof(int));
+        schema->roles[numColumns++] = role;
+        if (role != FIELD_SKIP) {
+            schema->numFields = numColumns;
+        }
+        if (comma >= end) {
+            break;
+        }
+        cursor = comma + 1;
+    }
+
+    int ok = artist && song && year;
+    if (!artist || !song || !year) {
+        fprintf(stderr, "File %s is missing an artist, song or year column.\n", filename);
+    }
+    for (int v = 0; v < values->count; v++) {
+        if (!found[v]) {
+            fprintf(stderr, "File %s has no %s column.\n", filename, values->names[v]);
+            ok = 0;
+        }
+    }
+    if (!ok) {
+        free(schema->roles);
+        schema->roles = NULL;
+        schema->numFields = 0;
+    }
+    return ok;
+}
+
+/**
+ * Function: looksNumeric
+ * ----------------------
+ * @brief Tells whether a field holds a plain decimal number such as `87`, `-5.2` or `1.5e-3`.
+ *
+ * An empty field says nothing about its column and counts as a number.
+ *
+ * @return int 1 if the field is a number or empty, 0 otherwise.
+ */
+int looksNumeric(StrView field) {
+    const char* p = field.data;
+    const char* end = field.data + field.len;
+    int digits = 0;
+
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    while (end > p && end[-1] == ' ') {
+        end--;
+    }
+    if (p == end) {
+        return 1;
+    }
+    if (*p == '-' || *p == '+') {
+        p++;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        digits++;
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            digits++;
+        }
+    }
+    if (digits > 0 && p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '-' || *p == '+')) {
+            p++;
+        }
+        if (p == end || *p < '0' || *p > '9') {
+            return 0;
+        }
+        while (p < end && *p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+    return digits > 0 && p == end;
+}
+
+/**
+ * Function: discoverValueColumns
+ * ------------------------------
+ * @brief Requests the numeric columns of a file as value columns, except year.
+ *
+ * Columns are named by the header line and told apart by the first row: a column whose field in that row is
+ * not a number, such as `explicit` or `genre`, is left out, as are artist and song. A file with no rows keeps
+ * every column. The names are copied without their quotes and blanks into `names`, which owns them.
+ *
+ * @param header The header line.
+ * @param firstRow The first row of the file, or NULL if it has none.
+ *
+ * @return nothing
+ */
+void discoverValueColumns(StrView header, const StrView* firstRow, ValueColumns* values, char** names) {
+    const char* cursor = header.data;
+    const char* end = header.data + header.len;
+    const char* rowCursor = firstRow != NULL ? firstRow->data : NULL;
+    const char* rowEnd = firstRow != NULL ? firstRow->data + firstRow->len : NULL;
+
+    for (;;) {
+        StrView name;
+        const char* comma = splitField(cursor, end, &name);
+        int numeric = 1;
+        if (rowCursor != NULL) {
+            StrView field = { rowCursor, 0 };
+            if (rowCursor <= rowEnd) {
+                const char* rowComma = splitField(rowCursor, rowEnd, &field);
+                rowCursor = rowComma + 1;
+            }
+            numeric = looksNumeric(field);
+        }
+
+        while (name.len > 0 && (name.data[0] == ' ' || name.data[0] == '"')) {
+            name.data++;
+            name.len--;
+        }
+        while (name.len > 0 && (name.data[name.len - 1] == ' ' || name.data[name.len - 1] == '"')) {
+            name.len--;
+        }
+        if (name.len > 0 && numeric && !fieldNameEquals(name, "artist") && !fieldNameEquals(name, "song") &&
+            !fieldNameEquals(name, "year")) {
+            int count = values->count;
+            names[count] = strndup(name.data, name.len);
+            int slot = requestValueColumn(values, names[count]);
+            if (slot < 0) {
+                fprintf(stderr, "Too many columns, not loading %s.\n", names[count]);
+            }
+            if (slot != count) {
+                free(names[count]);
+                names[count] = NULL;
+            }
+        }
+        if (comma >= end) {
+            break;
+        }
+        cursor = comma + 1;
+    }
+}
+
+/**
+ * Function: parseLine
+ * -------------------
+ * @brief Parses a line of CSV data and appends its song information to a table.
+ *
+ * The line is split in place with splitField: the artist and song of the row are stored as offsets into the
+ * mapped file, nothing is copied. Empty fields are kept, so a missing value does not shift the columns after
+ * it, and quoted fields may contain commas.
+ *
+ * Filters are checked as soon as their column is converted: a rejected row stops being parsed and does not
+ * take up a row of the table.
+ *
+ * @param line The line of CSV data to be parsed. It must lie inside the table's `text`.
+ * @param schema The layout of the file the line comes from. Only the fields it needs are converted.
+ * @param values The value columns of the run and the ranges they must fall in.
+ * @param table The table the row is appended to.
+ *
+ * @return int 1 if the row was appended, 0 if a filter rejected it.
+ */
+int parseLine(StrView line, const Schema* schema, const ValueColumns* values, SongTable* table) {
+    const char* cursor = line.data;
+    const char* end = line.data + line.len;
+    size_t row = table->rows;
     int field = 0;
 
-    while (token != NULL) {
-        switch (field) {
-            case 0:
-                *artist = emalloc(strlen(token) + 1); // Allocate memory for artist
-                strcpy(*artist, token);
-                break;
-            case 1:
-                *song = emalloc(strlen(token) + 1); // Allocate memory for song
-                strcpy(*song, token);
-                break;
-            case 4:
-                *year = atoi(token);
-                break;
-            case 5:
-                if (strcmp(options->sortBy, "popularity") == 0) {
-                    *sorting = atof(token);
-                }
-                break;
-            case 6:
-                if (strcmp(options->sortBy, "danceability") == 0) {
-                    *sorting = atof(token);
-                }
-                break;
-            case 7:
-                if (strcmp(options->sortBy, "energy") == 0) {
-                    *sorting = atof(token);
+    if (row == table->capacity) {
+        song_table_reserve(table, table->capacity > 0 ? 2 * table->capacity : 1024);
+    }
+    table->artist_off[row] = (size_t)(line.data - table->text);
+    table->artist_len[row] = 0;
+    table->song_off[row] = table->artist_off[row];
+    table->song_len[row] = 0;
+    table->year[row] = 0;
+    for (int v = 0; v < table->numValues; v++) {
+        table->values[v][row] = 0;
+    }
+
+    while (field < schema->numFields) {
+        StrView token;
+        const char* comma = splitField(cursor, end, &token);
+        int role = schema->roles[field];
+
+        if (role >= 0) {
+            float value = parseDoubleField(token);
+            if (valueRejected(values, role, value)) {
+                return 0;
+            }
+            table->values[role][row] = value;
+        } else if (role == FIELD_ARTIST) {
+            table->artist_off[row] = (size_t)(token.data - table->text);
+            table->artist_len[row] = (unsigned int)token.len;
+        } else if (role == FIELD_SONG) {
+            table->song_off[row] = (size_t)(token.data - table->text);
+            table->song_len[row] = (unsigned int)token.len;
+        } else if (role == FIELD_YEAR) {
+            table->year[row] = parseIntField(token);
+        }
+        if (comma >= end) {
+            break;
+        }
+        field++;
+        cursor = comma + 1;
+    }
+    if (field + 1 < schema->numFields) {
+        for (int v = 0; v < table->numValues; v++) {
+            if (valueRejected(values, v, table->values[v][row])) {
+                return 0;
+            }
+        }
+    }
+    table->rows++;
+    return 1;
+}
+
+/**
+ * Function: createNode
+ * --------------------
+ * @brief Creates a new node for the linked list with the provided data.
+ *
+ * The node is allocated from the arena and refers to the given strings without copying them,
+ * so they must live in the same arena.
+ *
+ * @param arena The arena the node is allocated from.
+ * @param artist The artist name to be associated with the new node.
+ * @param song The song name to be associated with the new node.
+ * @param year The year value to be associated with the new node.
+ * @param sorting The sorting value to be associated with the new node.
+ *
+ * @return node_t* A pointer to the newly created node.
+ *
+ */
+node_t* createNode(Arena* arena, char* artist, char* song, int year, float sorting) {
+    node_t* new_node = arena_alloc(arena, sizeof(node_t));
+    STATS_COUNT(COUNT_LIST_NODES, 1);
+    new_node->artist = artist;
+    new_node->song = song;
+    new_node->year = year;
+    new_node->sorting = sorting;
+    new_node->next = NULL;
+    return new_node;
+}
+
+/**
+ * @brief An entry of the top-K heap: the key of a candidate row and where to find the row.
+ */
+typedef struct {
+    float key;
+    int table;
+    size_t row;
+} TopKEntry;
+
+/**
+ * @brief A fixed-capacity binary min-heap that keeps the best `display` songs seen so far.
+ *
+ * The root is always the weakest survivor, so a new row only has to beat the root to get in.
+ */
+typedef struct {
+    TopKEntry* entries;
+    int size;
+    int capacity;
+} TopK;
+
+/**
+ * Function: topk_init
+ * -------------------
+ * @brief Initializes an empty top-K heap able to hold `capacity` rows.
+ *
+ * @param heap A pointer to the heap to be initialized.
+ * @param capacity The maximum number of rows to keep.
+ *
+ * @return nothing
+ */
+void topk_init(TopK* heap, int capacity) {
+    heap->size = 0;
+    heap->capacity = capacity > 0 ? capacity : 0;
+    heap->entries = heap->capacity > 0 ? emalloc(heap->capacity * sizeof(TopKEntry)) : NULL;
+    if (heap->entries != NULL) {
+        STATS_ALLOCATION(heap->capacity * sizeof(TopKEntry));
+    }
+}
+
+/**
+ * Function: topk_ranks_below
+ * --------------------------
+ * @brief Tells whether entry `a` ranks below entry `b` in the output order.
+ *
+ * Songs are ordered by descending key; on a tie the song read first ranks higher. Tables are numbered in input
+ * order, so the input order of a row is its (table, row) pair.
+ *
+ * @return int 1 if `a` ranks below `b`, 0 otherwise.
+ */
+int topk_ranks_below(const TopKEntry* a, const TopKEntry* b) {
+    if (a->key != b->key) {
+        return a->key < b->key;
+    }
+    if (a->table != b->table) {
+        return a->table > b->table;
+    }
+    return a->row > b->row;
+}
+
+/**
+ * Function: topk_sift_down
+ * ------------------------
+ * @brief Restores the heap property from index `i` down, considering the first `size` entries.
+ *
+ * @return nothing
+ */
+void topk_sift_down(TopKEntry* entries, int size, int i) {
+    TopKEntry moving = entries[i];
+
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= size) {
+            break;
+        }
+        if (child + 1 < size && topk_ranks_below(&entries[child + 1], &entries[child])) {
+            child++;
+        }
+        if (!topk_ranks_below(&entries[child], &moving)) {
+            break;
+        }
+        entries[i] = entries[child];
+        i = child;
+    }
+    entries[i] = moving;
+}
+
+/**
+ * Function: topk_push
+ * -------------------
+ * @brief Offers a row to the heap, evicting the weakest survivor if the heap is full.
+ *
+ * @param heap A pointer to the heap.
+ * @param entry The candidate row.
+ *
+ * @return int 1 if the row was kept, 0 if it ranks below every survivor of a full heap.
+ */
+int topk_push(TopK* heap, const TopKEntry* entry) {
+    STATS_COUNT(COUNT_HEAP_PUSHES, 1);
+    if (heap->size < heap->capacity) {
+        int i = heap->size++;
+        while (i > 0) {
+            int parent = (i - 1) / 2;
+            if (!topk_ranks_below(entry, &heap->entries[parent])) {
+                break;
+            }
+            heap->entries[i] = heap->entries[parent];
+            i = parent;
+        }
+        heap->entries[i] = *entry;
+        return 1;
+    }
+
+    if (heap->capacity == 0 || !topk_ranks_below(&heap->entries[0], entry)) {
+        return 0;
+    }
+    STATS_COUNT(COUNT_HEAP_EVICTIONS, 1);
+    heap->entries[0] = *entry;
+    topk_sift_down(heap->entries, heap->size, 0);
+    return 1;
+}
+
+/**
+ * Function: topk_select
+ * ---------------------
+ * @brief Runs the top-N pass over the --sortBy column of a table.
+ *
+ * Once the heap is full, a row has to beat the weakest survivor to get in, so the loop over the contiguous
+ * column rejects most rows with a single float comparison. The ranges of `filters` are only checked for the
+ * rows that get that far.
+ *
+ * @param heap A pointer to the heap.
+ * @param table The table to scan.
+ * @param table_index The position of the table in the input.
+ * @param filters The ranges the values of a row must fall in, or NULL if the table was filtered while parsing.
+ *
+ * @return nothing
+ */
+void topk_select(TopK* heap, const SongTable* table, int table_index, const ValueColumns* filters) {
+    const float* keys = table->values[0];
+
+    STATS_COUNT(COUNT_HEAP_OFFERS, table->rows);
+    for (size_t row = 0; row < table->rows; row++) {
+        if (heap->size == heap->capacity && (heap->capacity == 0 || keys[row] <= heap->entries[0].key)) {
+            continue;
+        }
+        if (filters != NULL) {
+            int rejected = 0;
+            for (int v = 0; v < filters->count && !rejected; v++) {
+                rejected = valueRejected(filters, v, table->values[v][row]);
+            }
+            if (rejected) {
+                continue;
+            }
+        }
+        TopKEntry entry;
+        entry.key = keys[row];
+        entry.table = table_index;
+        entry.row = row;
+        topk_push(heap, &entry);
+    }
+}
+
+/**
+ * Function: topk_to_list
+ * ----------------------
+ * @brief Sorts the survivors in place and materializes them as a list in output order.
+ *
+ * This is the only place song records are built: the artist and song of each survivor are copied out of its
+ * table's mapped file into the arena. The heap is empty afterwards and its storage is released.
+ *
+ * @param heap A pointer to the heap.
+ * @param tables The tables the survivors were selected from.
+ * @param arena The arena that owns the nodes and strings of the returned list.
+ *
+ * @return node_t* The head of the sorted list, or NULL if the heap was empty.
+ */
+node_t* topk_to_list(TopK* heap, const SongTable* tables, Arena* arena) {
+    node_t* list = NULL;
+
+    for (int end = heap->size - 1; end > 0; end--) {
+        TopKEntry weakest = heap->entries[0];
+        heap->entries[0] = heap->entries[end];
+        heap->entries[end] = weakest;
+        topk_sift_down(heap->entries, end, 0);
+    }
+    for (int i = heap->size - 1; i >= 0; i--) {
+        const SongTable* table = &tables[heap->entries[i].table];
+        size_t row = heap->entries[i].row;
+        char* artist = arena_strndup(arena, table->text + table->artist_off[row], table->artist_len[row]);
+        char* song = arena_strndup(arena, table->text + table->song_off[row], table->song_len[row]);
+        node_t* node = createNode(arena, artist, song, table->year[row], heap->entries[i].key);
+        node->next = list;
+        list = node;
+    }
+
+    free(heap->entries);
+    heap->entries = NULL;
+    heap->size = 0;
+    return list;
+}
+
+/**
+ * @brief A row of one of the tables of a run, as (table, row).
+ */
+typedef struct {
+    int table;
+    unsigned int row;
+} SortedRow;
+
+/**
+ * @brief The number of leading bytes of artist and song the radix passes order text by; only runs of texts that
+ * share them and are longer fall back to comparing whole texts.
+ */
+#define SORT_PREFIX_BYTES 16
+
+/**
+ * Function: createRowNode
+ * -----------------------
+ * @brief Creates a list node for a row of a table, copying its artist and song into the arena.
+ *
+ * @return node_t* The new node.
+ */
+node_t* createRowNode(Arena* arena, const SongTable* table, size_t row, float sorting) {
+    char* artist = arena_strndup(arena, table->text + table->artist_off[row], table->artist_len[row]);
+    char* song = arena_strndup(arena, table->text + table->song_off[row], table->song_len[row]);
+    return createNode(arena, artist, song, table->year[row], sorting);
+}
+
+/**
+ * Function: sort_spec_value
+ * -------------------------
+ * @brief Returns the value of the shown key of a spec for a row, the sorting value of its node.
+ *
+ * @return float The value, or 0 if the spec shows no key.
+ */
+float sort_spec_value(const SortSpec* spec, const SongTable* table, size_t row) {
+    return spec->shown >= 0 ? table->values[spec->roles[spec->shown]][row] : 0;
+}
+
+/**
+ * Function: ascending_key
+ * -----------------------
+ * @brief Maps a value to an integer key whose ascending order is the ascending order of the values.
+ *
+ * The bits of a float order like its value once the sign bit is flipped for positive values and every bit is
+ * flipped for negative ones. -0 is folded into 0, as they compare equal. Inverting the key gives the
+ * descending order.
+ *
+ * @return unsigned int The key of the value.
+ */
+unsigned int ascending_key(float value) {
+    unsigned int bits;
+
+    if (value == 0) {
+        value = 0;
+    }
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+}
+
+/**
+ * Function: radix_sort_rows
+ * -------------------------
+ * @brief Sorts row numbers by their keys with a stable LSD radix sort, one byte of the key per pass.
+ *
+ * Passes over a byte that is the same in every key are skipped. Rows with equal keys keep their order.
+ *
+ * @param keys The key of every row. Used as scratch space.
+ * @param rows The row numbers to sort, in the order ties are broken.
+ * @param count The number of rows.
+ *
+ * @return nothing
+ */
+void radix_sort_rows(unsigned int* keys, unsigned int* rows, size_t count) {
+    unsigned int* keysTo = emalloc((count > 0 ? count : 1) * sizeof(unsigned int));
+    unsigned int* rowsTo = emalloc((count > 0 ? count : 1) * sizeof(unsigned int));
+    unsigned int* keysFrom = keys;
+    unsigned int* rowsFrom = rows;
+
+    STATS_ALLOCATION(2 * (count > 0 ? count : 1) * sizeof(unsigned int));
+    for (int shift = 0; shift < 32 && count > 1; shift += 8) {
+        size_t counts[256] = { 0 };
+        for (size_t i = 0; i < count; i++) {
+            counts[(keysFrom[i] >> shift) & 255]++;
+        }
+        if (counts[(keysFrom[0] >> shift) & 255] == count) {
+            continue;
+        }
+        STATS_COUNT(COUNT_SORT_PASSES, 1);
+        size_t offset = 0;
+        for (int b = 0; b < 256; b++) {
+            size_t n = counts[b];
+            counts[b] = offset;
+            offset += n;
+        }
+        for (size_t i = 0; i < count; i++) {
+            size_t to = counts[(keysFrom[i] >> shift) & 255]++;
+            keysTo[to] = keysFrom[i];
+            rowsTo[to] = rowsFrom[i];
+        }
+        unsigned int* swap = keysFrom;
+        keysFrom = keysTo;
+        keysTo = swap;
+        swap = rowsFrom;
+        rowsFrom = rowsTo;
+        rowsTo = swap;
+    }
+    if (rowsFrom != rows) {
+        memcpy(rows, rowsFrom, count * sizeof(unsigned int));
+        free(rowsFrom);
+        free(keysFrom);
+    } else {
+        free(rowsTo);
+        free(keysTo);
+    }
+}
+
+/**
+ * Function: radix_select
+ * ----------------------
+ * @brief Finds the n-th smallest of a set of keys, one byte at a time from the most significant.
+ *
+ * Each pass counts the next byte of the keys that share the bytes chosen so far, so the whole selection is
+ * four passes over the keys, however they are distributed.
+ *
+ * @param n The rank of the key to find, from 1 to `count`.
+ *
+ * @return unsigned int The n-th smallest key.
+ */
+unsigned int radix_select(const unsigned int* keys, size_t count, size_t n) {
+    unsigned int prefix = 0, mask = 0;
+
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        size_t counts[256] = { 0 };
+        for (size_t i = 0; i < count; i++) {
+            if ((keys[i] & mask) == prefix) {
+                counts[(keys[i] >> shift) & 255]++;
+            }
+        }
+        int b = 0;
+        while (counts[b] < n) {
+            n -= counts[b];
+            b++;
+        }
+        prefix |= (unsigned int)b << shift;
+        mask |= 255u << shift;
+    }
+    return prefix;
+}
+
+/**
+ * @brief The value of an artist or song field: the field itself, or the text between the quotes of a quoted
+ * field. `escaped` is set when that text holds doubled quotes, each of which stands for one quote of the value.
+ */
+typedef struct {
+    const char* data;
+    size_t len;
+    int escaped;
+} TextValue;
+
+/**
+ * Function: row_text
+ * ------------------
+ * @brief Finds the value of the artist or the song of a row.
+ *
+ * @return TextValue The value, which is not NUL-terminated.
+ */
+TextValue row_text(const SongTable* tables, SortedRow row, int role) {
+    const SongTable* table = &tables[row.table];
+    TextValue text;
+
+    if (role == FIELD_ARTIST) {
+        text.data = table->text + table->artist_off[row.row];
+        text.len = table->artist_len[row.row];
+    } else {
+        text.data = table->text + table->song_off[row.row];
+        text.len = table->song_len[row.row];
+    }
+    text.escaped = 0;
+    if (text.len >= 2 && text.data[0] == '"' && text.data[text.len - 1] == '"') {
+        text.data++;
+        text.len -= 2;
+        text.escaped = memchr(text.data, '"', text.len) != NULL;
+    }
+    return text;
+}
+
+/**
+ * Function: text_prefix
+ * ---------------------
+ * @brief Copies the first SORT_PREFIX_BYTES bytes of a value into `prefix`, padded with zeros.
+ *
+ * @return size_t The length of the value, or SORT_PREFIX_BYTES + 1 if it is longer than the prefix.
+ */
+size_t text_prefix(TextValue text, unsigned char* prefix) {
+    size_t n = 0, i = 0;
+
+    memset(prefix, 0, SORT_PREFIX_BYTES);
+    while (i < text.len && n < SORT_PREFIX_BYTES) {
+        prefix[n++] = (unsigned char)text.data[i];
+        i += text.escaped && text.data[i] == '"' ? 2 : 1;
+    }
+    return i < text.len ? SORT_PREFIX_BYTES + 1 : n;
+}
+
+/**
+ * Function: compare_text
+ * ----------------------
+ * @brief Compares two values byte by byte; a value that is a prefix of the other comes first.
+ *
+ * @return int A negative number, 0 or a positive number as `a` sorts before, with or after `b`.
+ */
+int compare_text(TextValue a, TextValue b) {
+    if (!a.escaped && !b.escaped) {
+        int c = memcmp(a.data, b.data, a.len < b.len ? a.len : b.len);
+        if (c != 0) {
+            return c;
+        }
+        return (a.len > b.len) - (a.len < b.len);
+    }
+
+    size_t i = 0, j = 0;
+    while (i < a.len && j < b.len) {
+        unsigned char x = (unsigned char)a.data[i], y = (unsigned char)b.data[j];
+        if (x != y) {
+            return x - y;
+        }
+        i += a.escaped && x == '"' ? 2 : 1;
+        j += b.escaped && y == '"' ? 2 : 1;
+    }
+    return (i < a.len) - (j < b.len);
+}
+
+/**
+ * Function: merge_sort_text
+ * -------------------------
+ * @brief Sorts positions in `rows` by the text of their rows with a stable merge sort.
+ *
+ * @param order The positions to sort.
+ * @param scratch Room for `count` positions.
+ *
+ * @return nothing
+ */
+void merge_sort_text(unsigned int* order, unsigned int* scratch, size_t count, const SongTable* tables,
+                     const SortedRow* rows, int role) {
+    if (count < 2) {
+        return;
+    }
+    size_t half = count / 2;
+    merge_sort_text(order, scratch, half, tables, rows, role);
+    merge_sort_text(order + half, scratch, count - half, tables, rows, role);
+
+    size_t i = 0, j = half, n = 0;
+    while (i < half && j < count) {
+        TextValue a = row_text(tables, rows[order[i]], role);
+        TextValue b = row_text(tables, rows[order[j]], role);
+        scratch[n++] = compare_text(b, a) < 0 ? order[j++] : order[i++];
+    }
+    while (i < half) {
+        scratch[n++] = order[i++];
+    }
+    while (j < count) {
+        scratch[n++] = order[j++];
+    }
+    memcpy(order, scratch, count * sizeof(unsigned int));
+}
+
+/**
+ * Function: text_ranks
+ * --------------------
+ * @brief Ranks the artists or songs of a set of rows, so equal values share a rank and ranks follow byte order.
+ *
+ * Values are compared without the quotes of a quoted field, so `"Smith"` ranks with `Smith`. The rows are
+ * radix-sorted by the first SORT_PREFIX_BYTES bytes of their value, four bytes per key. Values that share
+ * those bytes are equal unless one is longer, so only runs holding a longer value are merge-sorted by their
+ * whole value. A text key then sorts like a numeric one, by its rank.
+ *
+ * @param role FIELD_ARTIST or FIELD_SONG.
+ * @param ranks Receives the rank of every row.
+ *
+ * @return nothing
+ */
+void text_ranks(const SongTable* tables, const SortedRow* rows, size_t count, int role, unsigned int* ranks) {
+    unsigned int* order = emalloc((count > 0 ? count : 1) * sizeof(unsigned int));
+    unsigned int* keys = emalloc((count > 0 ? count : 1) * sizeof(unsigned int));
+    unsigned char prefix[SORT_PREFIX_BYTES], otherPrefix[SORT_PREFIX_BYTES];
+
+    STATS_ALLOCATION(2 * (count > 0 ? count : 1) * sizeof(unsigned int));
+    for (size_t i = 0; i < count; i++) {
+        order[i] = (unsigned int)i;
+    }
+    for (int word = SORT_PREFIX_BYTES / 4 - 1; word >= 0; word--) {
+        for (size_t i = 0; i < count; i++) {
+            text_prefix(row_text(tables, rows[order[i]], role), prefix);
+            const unsigned char* bytes = prefix + word * 4;
+            keys[i] = (unsigned int)bytes[0] << 24 | (unsigned int)bytes[1] << 16 | (unsigned int)bytes[2] << 8 |
+                      bytes[3];
+        }
+        radix_sort_rows(keys, order, count);
+    }
+
+    for (size_t i = 0; i < count;) {
+        size_t len = text_prefix(row_text(tables, rows[order[i]], role), prefix);
+        int longer = len > SORT_PREFIX_BYTES;
+        size_t j = i + 1;
+        for (; j < count; j++) {
+            size_t otherLen = text_prefix(row_text(tables, rows[order[j]], role), otherPrefix);
+            if (memcmp(prefix, otherPrefix, SORT_PREFIX_BYTES) != 0) {
+                break;
+            }
+            longer |= otherLen > SORT_PREFIX_BYTES || otherLen != len;
+        }
+        if (longer && j - i > 1) {
+            STATS_COUNT(COUNT_SORT_FALLBACK_ROWS, j - i);
+            merge_sort_text(order + i, keys, j - i, tables, rows, role);
+        }
+        i = j;
+    }
+
+    unsigned int rank = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            TextValue previous = row_text(tables, rows[order[i - 1]], role);
+            rank += compare_text(previous, row_text(tables, rows[order[i]], role)) != 0;
+        }
+        ranks[order[i]] = rank;
+    }
+    free(keys);
+    free(order);
+}
+
+/**
+ * Function: sort_key_words
+ * ------------------------
+ * @brief Encodes key `k` of a spec for a set of rows as integers whose ascending order is the order of the key.
+ *
+ * Numbers map through ascending_key, years by flipping their sign bit and texts to their rank; a descending
+ * key is the inverse of its ascending one.
+ *
+ * @param words Receives the encoded key of every row.
+ *
+ * @return nothing
+ */
+void sort_key_words(const SortSpec* spec, int k, const SongTable* tables, const SortedRow* rows, size_t count,
+                    unsigned int* words) {
+    int role = spec->roles[k];
+    unsigned int flip = spec->descending[k] ? ~0u : 0u;
+
+    if (role == FIELD_ARTIST || role == FIELD_SONG) {
+        text_ranks(tables, rows, count, role, words);
+    } else if (role == FIELD_YEAR) {
+        for (size_t i = 0; i < count; i++) {
+            words[i] = (unsigned int)tables[rows[i].table].year[rows[i].row] ^ 0x80000000u;
+        }
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            words[i] = ascending_key(tables[rows[i].table].values[role][rows[i].row]);
+        }
+    }
+    for (size_t i = 0; i < count; i++) {
+        words[i] ^= flip;
+    }
+}
+
+/**
+ * Function: sort_rows
+ * -------------------
+ * @brief Orders rows by a resolved spec and keeps the first `limit`.
+ *
+ * Every key of a row is encoded as a 32-bit word, so the composite key is a fixed-width string of words that a
+ * stable LSD radix sort orders one word at a time, least significant key first, with no comparator at all.
+ * When only the first `limit` rows are wanted, radix_select finds the `limit`-th word of the first key and
+ * every row past it is dropped before the other keys are even encoded. Rows equal on every key keep the
+ * order they are given in.
+ *
+ * @param rows The rows to sort, in input order. They are reordered in place.
+ * @param count The number of rows.
+ * @param limit The number of rows wanted.
+ *
+ * @return size_t The number of rows kept at the front of `rows`, at most `limit`.
+ */
+size_t sort_rows(const SortSpec* spec, const SongTable* tables, SortedRow* rows, size_t count, size_t limit) {
+    if (limit > count) {
+        limit = count;
+    }
+    if (limit == 0) {
+        return 0;
+    }
+    if (count > UINT_MAX) {
+        fprintf(stderr, "Too many songs to sort: %zu.\n", count);
+        return 0;
+    }
+    unsigned int* first = emalloc(count * sizeof(unsigned int));
+    STATS_ALLOCATION(count * sizeof(unsigned int));
+    sort_key_words(spec, 0, tables, rows, count, first);
+    if (limit < count) {
+        unsigned int bound = radix_select(first, count, limit);
+        size_t kept = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (first[i] <= bound) {
+                rows[kept] = rows[i];
+                first[kept] = first[i];
+                kept++;
+            }
+        }
+        count = kept;
+    }
+    STATS_COUNT(COUNT_SORT_ROWS, count);
+
+    unsigned int* order = emalloc(count * sizeof(unsigned int));
+    unsigned int* words = emalloc(count * sizeof(unsigned int));
+    unsigned int* keys = emalloc(count * sizeof(unsigned int));
+    STATS_ALLOCATION(3 * count * sizeof(unsigned int));
+    for (size_t i = 0; i < count; i++) {
+        order[i] = (unsigned int)i;
+    }
+    for (int k = spec->numKeys - 1; k >= 0; k--) {
+        if (k > 0) {
+            sort_key_words(spec, k, tables, rows, count, words);
+        }
+        const unsigned int* encoded = k > 0 ? words : first;
+        for (size_t i = 0; i < count; i++) {
+            keys[i] = encoded[order[i]];
+        }
+        radix_sort_rows(keys, order, count);
+    }
+
+    SortedRow* sorted = emalloc(limit * sizeof(SortedRow));
+    STATS_ALLOCATION(limit * sizeof(SortedRow));
+    for (size_t i = 0; i < limit; i++) {
+        sorted[i] = rows[order[i]];
+    }
+    memcpy(rows, sorted, limit * sizeof(SortedRow));
+    free(sorted);
+    free(keys);
+    free(words);
+    free(order);
+    free(first);
+    return limit;
+}
+
+/**
+ * @brief The size of the byte ranges a large CSV file is split into for parallel ingest.
+ */
+#define INGEST_CHUNK_SIZE (16 << 20)
+
+/**
+ * @brief A byte range of rows in one mapped file, and the table its rows are parsed into.
+ *
+ * Units are numbered in input order, so (unit, row) is the position of a row in the whole input. A
+ * `preloaded` unit is a range of rows of a snapshot: its table points into the mapped snapshot, holds every
+ * row unfiltered, and is neither parsed nor freed.
+ */
+typedef struct {
+    const char* begin;
+    const char* end;
+    const Schema* schema;
+    SongTable table;
+    int preloaded;
+} IngestUnit;
+
+/**
+ * @brief The work shared by all ingest threads: the units still to be parsed and the value columns to read.
+ */
+typedef struct {
+    const ValueColumns* values;
+    IngestUnit* units;
+    int numUnits;
+    int nextUnit;
+    pthread_mutex_t lock;
+} IngestJob;
+
+/**
+ * @brief One ingest thread, the top-K heap of the units it parsed, and its --stats once it has finished.
+ */
+typedef struct {
+    IngestJob* job;
+    TopK heap;
+    pthread_t thread;
+    Stats stats;
+} IngestWorker;
+
+/**
+ * Function: splitIntoUnits
+ * ------------------------
+ * @brief Splits the rows of a mapped file into units of about INGEST_CHUNK_SIZE bytes each.
+ *
+ * The header line is skipped and every unit boundary is moved to the start of the next line, so a row is
+ * never split across two units.
+ *
+ * @param mapped The mapped CSV file.
+ * @param schema The layout of the file, resolved from its header.
+ * @param numValues The number of value columns each unit's table stores.
+ * @param units A pointer to the array of units, grown as needed.
+ * @param numUnits A pointer to the number of units in the array.
+ *
+ * @return nothing
+ */
+void splitIntoUnits(const MappedFile* mapped, const Schema* schema, int numValues, IngestUnit** units, int* numUnits) {
+    const char* end = mapped->data + mapped->size;
+    const char* cursor = mapped->data;
+    StrView header;
+
+    nextLine(&cursor, end, &header);
+    while (cursor < end) {
+        const char* stop = end;
+        if ((size_t)(end - cursor) > INGEST_CHUNK_SIZE) {
+            const char* newline = memchr(cursor + INGEST_CHUNK_SIZE, '\n', (size_t)(end - cursor) - INGEST_CHUNK_SIZE);
+            stop = newline != NULL ? newline + 1 : end;
+        }
+
+        *units = erealloc(*units, (*numUnits + 1) * sizeof(IngestUnit));
+        IngestUnit* unit = &(*units)[*numUnits];
+        memset(unit, 0, sizeof(IngestUnit));
+        unit->begin = cursor;
+        unit->end = stop;
+        unit->schema = schema;
+        unit->table.text = mapped->data;
+        unit->table.numValues = numValues;
+        (*numUnits)++;
+        cursor = stop;
+    }
+}
+
+/**
+ * Function: ingestWorker
+ * ----------------------
+ * @brief Thread body of the parallel ingest: parses units until none are left and keeps their top rows.
+ *
+ * The stage times and counters of the thread are copied into the worker before it returns.
+ *
+ * @param arg The IngestWorker of this thread.
+ *
+ * @return void* NULL.
+ */
+void* ingestWorker(void* arg) {
+    IngestWorker* worker = arg;
+    IngestJob* job = worker->job;
+    StatsMark mark = stats_now();
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        int u = job->nextUnit++;
+        pthread_mutex_unlock(&job->lock);
+        if (u >= job->numUnits) {
+            break;
+        }
+
+        IngestUnit* unit = &job->units[u];
+        const char* cursor = unit->begin;
+        StrView line;
+        while (!unit->preloaded && nextLine(&cursor, unit->end, &line)) {
+            if (line.len > 0) {
+                STATS_COUNT(COUNT_ROWS_PARSED, 1);
+                if (!parseLine(line, unit->schema, job->values, &unit->table)) {
+                    STATS_COUNT(COUNT_ROWS_REJECTED, 1);
                 }
-                break;
+            }
         }
-        field++;
-        token = strtok(NULL, ",");
+        stats_stage(STAGE_PARSE, &mark);
+        if (worker->heap.capacity > 0) {
+            topk_select(&worker->heap, &unit->table, u, unit->preloaded ? job->values : NULL);
+        }
+        stats_stage(STAGE_SELECT, &mark);
     }
+    worker->stats = threadStats;
+    return NULL;
 }
 
- 
+/**
+ * @brief The number of snapshot rows in each unit, so the top-N pass over a snapshot is shared by the threads.
+ */
+#define SNAPSHOT_UNIT_ROWS (1 << 20)
+
+/**
+ * @brief The space for the name of a column in a snapshot, including its terminating NUL.
+ */
+#define SNAPSHOT_NAME_SIZE 32
 
+/**
+ * @brief The magic string of a snapshot file, which carries its format version.
+ */
+#define SNAPSHOT_MAGIC "MMSNAP1"
 
 /**
- * Function: createNode
- * --------------------
- * @brief Creates a new node for the linked list with the provided data.
+ * @brief The header of a snapshot: what it is a snapshot of, and how many rows, columns and string bytes it holds.
  *
- * @param artist The artist name to be associated with the new node.
- * @param song The song name to be associated with the new node.
- * @param year The year value to be associated with the new node.
- * @param sorting The sorting value to be associated with the new node.
+ * A snapshot `<file>.snap` holds the songs of a CSV file already parsed, column by column in the layout of a
+ * SongTable: the header, the column names, the artist and song offsets and lengths, the years, every value
+ * column, and the string heap the offsets point into. It is only valid while the CSV file keeps the size and
+ * modification time recorded here, and only on a machine with the same `size_t`.
+ */
+typedef struct {
+    char magic[8];
+    long long size;
+    long long mtimeSec;
+    long long mtimeNsec;
+    long long rows;
+    long long textSize;
+    int numColumns;
+    int offsetSize;
+} SnapshotHeader;
+
+/**
+ * @brief Where each array of a snapshot starts, in bytes from the start of the file, and where the file ends.
+ */
+typedef struct {
+    size_t artistOff;
+    size_t songOff;
+    size_t artistLen;
+    size_t songLen;
+    size_t year;
+    size_t values;
+    size_t text;
+    size_t end;
+} SnapshotLayout;
+
+/**
+ * Function: snapshot_layout
+ * -------------------------
+ * @brief Lays out the arrays of a snapshot. Every array starts aligned for its type.
  *
- * @return node_t* A pointer to the newly created node.
+ * @return SnapshotLayout The offsets of the arrays.
+ */
+SnapshotLayout snapshot_layout(size_t rows, int numColumns, size_t textSize) {
+    SnapshotLayout layout;
+
+    layout.artistOff = sizeof(SnapshotHeader) + (size_t)numColumns * SNAPSHOT_NAME_SIZE;
+    layout.songOff = layout.artistOff + rows * sizeof(size_t);
+    layout.artistLen = layout.songOff + rows * sizeof(size_t);
+    layout.songLen = layout.artistLen + rows * sizeof(unsigned int);
+    layout.year = layout.songLen + rows * sizeof(unsigned int);
+    layout.values = layout.year + rows * sizeof(int);
+    layout.text = layout.values + (size_t)numColumns * rows * sizeof(float);
+    layout.end = layout.text + textSize;
+    return layout;
+}
+
+/**
+ * Function: snapshotFileName
+ * --------------------------
+ * @brief Builds the name of the snapshot of a CSV file.
  *
- */ 
-node_t* createNode(const char* artist, const char* song, int year, float sorting) {
-    node_t* new_node = emalloc(sizeof(node_t));
-    new_node->artist = emalloc(strlen(artist) + 1);
-    new_node->song = emalloc(strlen(song) + 1);
-    strcpy(new_node->artist, artist);
-    strcpy(new_node->song, song);
-    new_node->year = year;
-    new_node->sorting = sorting;
-    new_node->next = NULL;
-    return new_node;
+ * @return char* The name, to be freed by the caller.
+ */
+char* snapshotFileName(const char* filename) {
+    char* name = emalloc(strlen(filename) + 6);
+    strcpy(name, filename);
+    strcat(name, ".snap");
+    return name;
+}
+
+/**
+ * Function: mapSnapshot
+ * ---------------------
+ * @brief Maps the snapshot of a CSV file if it is still valid for the file.
+ *
+ * Besides the header, only the column names and the artist and song offsets and lengths are checked: every
+ * column name must be terminated within its space and every string must lie inside the string heap, so a
+ * corrupt snapshot is rejected instead of read out of bounds. The value columns and the heap itself are never
+ * read here, and only the pages of the columns a run reads are ever faulted in.
+ *
+ * @param filename The name of the CSV file.
+ * @param values The value columns the run needs, or NULL to only check that the snapshot is valid.
+ * @param mapped A pointer to store the mapping of the snapshot.
+ * @param columns Where to store the snapshot column of every value slot. Unused if `values` is NULL.
+ *
+ * @return int 1 if the snapshot is valid and has every column of `values`, 0 otherwise. Nothing is reported, so
+ * a snapshot that is not valid is simply replaced by a parse of the CSV file.
+ */
+int mapSnapshot(const char* filename, const ValueColumns* values, MappedFile* mapped, int* columns) {
+    struct stat csv, st;
+    if (stat(filename, &csv) != 0) {
+        return 0;
+    }
+    char* name = snapshotFileName(filename);
+    int fd = open(name, O_RDONLY);
+    free(name);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return 0;
+    }
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+    mapped->data = data;
+    mapped->size = (size_t)st.st_size;
+
+    const SnapshotHeader* header = data;
+    int ok = memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0 &&
+             header->offsetSize == (int)sizeof(size_t) && header->size == (long long)csv.st_size &&
+             header->mtimeSec == (long long)csv.st_mtim.tv_sec && header->mtimeNsec == (long long)csv.st_mtim.tv_nsec &&
+             header->rows >= 0 && header->textSize >= 0 && header->numColumns >= 0 &&
+             header->numColumns <= MAX_VALUE_COLUMNS && (unsigned long long)header->rows <= mapped->size &&
+             (unsigned long long)header->textSize <= mapped->size &&
+             snapshot_layout((size_t)header->rows, header->numColumns, (size_t)header->textSize).end == mapped->size;
+    const char* names = (const char*)data + sizeof(SnapshotHeader);
+    for (int c = 0; ok && c < header->numColumns; c++) {
+        ok = memchr(names + c * SNAPSHOT_NAME_SIZE, '\0', SNAPSHOT_NAME_SIZE) != NULL;
+    }
+    if (ok) {
+        size_t rows = (size_t)header->rows;
+        size_t textSize = (size_t)header->textSize;
+        SnapshotLayout layout = snapshot_layout(rows, header->numColumns, textSize);
+        const size_t* artistOff = (const size_t*)((const char*)data + layout.artistOff);
+        const size_t* songOff = (const size_t*)((const char*)data + layout.songOff);
+        const unsigned int* artistLen = (const unsigned int*)((const char*)data + layout.artistLen);
+        const unsigned int* songLen = (const unsigned int*)((const char*)data + layout.songLen);
+        for (size_t r = 0; ok && r < rows; r++) {
+            ok = artistOff[r] <= textSize && artistLen[r] <= textSize - artistOff[r] && songOff[r] <= textSize &&
+                 songLen[r] <= textSize - songOff[r];
+        }
+    }
+    for (int v = 0; ok && values != NULL && v < values->count; v++) {
+        columns[v] = -1;
+        for (int c = 0; c < header->numColumns; c++) {
+            if (strncmp(names + c * SNAPSHOT_NAME_SIZE, values->names[v], SNAPSHOT_NAME_SIZE) == 0) {
+                columns[v] = c;
+                break;
+            }
+        }
+        ok = columns[v] >= 0;
+    }
+    if (!ok) {
+        unmapFile(mapped);
+    }
+    return ok;
+}
+
+/**
+ * Function: addSnapshotUnits
+ * --------------------------
+ * @brief Splits the rows of a mapped snapshot into preloaded units whose tables point into the snapshot.
+ *
+ * @param mapped The mapped snapshot.
+ * @param numValues The number of value columns of the run.
+ * @param columns The snapshot column of every value slot.
+ * @param units A pointer to the array of units, grown as needed.
+ * @param numUnits A pointer to the number of units in the array.
+ *
+ * @return nothing
+ */
+void addSnapshotUnits(const MappedFile* mapped, int numValues, const int* columns, IngestUnit** units, int* numUnits) {
+    const SnapshotHeader* header = (const SnapshotHeader*)mapped->data;
+    size_t rows = (size_t)header->rows;
+    SnapshotLayout layout = snapshot_layout(rows, header->numColumns, (size_t)header->textSize);
+    char* base = (char*)mapped->data;
+
+    STATS_COUNT(COUNT_SNAPSHOT_ROWS, rows);
+    for (size_t first = 0; first < rows; first += SNAPSHOT_UNIT_ROWS) {
+        *units = erealloc(*units, (*numUnits + 1) * sizeof(IngestUnit));
+        IngestUnit* unit = &(*units)[*numUnits];
+        SongTable* table = &unit->table;
+        memset(unit, 0, sizeof(IngestUnit));
+        unit->preloaded = 1;
+        table->text = base + layout.text;
+        table->rows = rows - first < SNAPSHOT_UNIT_ROWS ? rows - first : SNAPSHOT_UNIT_ROWS;
+        table->capacity = table->rows;
+        table->artist_off = (size_t*)(base + layout.artistOff) + first;
+        table->song_off = (size_t*)(base + layout.songOff) + first;
+        table->artist_len = (unsigned int*)(base + layout.artistLen) + first;
+        table->song_len = (unsigned int*)(base + layout.songLen) + first;
+        table->year = (int*)(base + layout.year) + first;
+        table->numValues = numValues;
+        for (int v = 0; v < numValues; v++) {
+            table->values[v] = (float*)(base + layout.values) + (size_t)columns[v] * rows + first;
+        }
+        (*numUnits)++;
+    }
 }
-void extractDataFromCSV(Options options, node_t** list) {
-    for (int i = 0; i < options.numFiles; i++) {
-        FILE* file = openFileForReading(options.files[i]);
-        if (file == NULL) {
+
+/**
+ * @brief The CSV files of a run, mapped and split into units, and the layout of each file.
+ *
+ * Once ingested, the unit tables hold the rows of every file in input order. The tables refer to the mapped
+ * files, so the catalogue must stay open for as long as its rows are read. `mapped[i]` is the snapshot of
+ * file `i` when a valid one was found, and the CSV file itself otherwise.
+ */
+typedef struct {
+    int numFiles;
+    MappedFile* mapped;
+    Schema* schemas;
+    IngestJob job;
+} Catalogue;
+
+/**
+ * Function: catalogue_open
+ * ------------------------
+ * @brief Maps the files of a run, resolves their headers and splits their rows into units.
+ *
+ * A file with a valid snapshot that has every column of `values` is not read at all: its rows come from the
+ * snapshot as preloaded units. Files that cannot be mapped or lack a column of `values` are reported and left
+ * out.
+ *
+ * @param catalogue A pointer to the catalogue to be opened.
+ * @param files The names of the CSV files, in input order.
+ * @param numFiles The number of files.
+ * @param values The value columns every row must provide. They must outlive the catalogue.
+ *
+ * @return int 1 if every file that could be read has every column of `values`, 0 otherwise.
+ */
+int catalogue_open(Catalogue* catalogue, char** files, int numFiles, const ValueColumns* values) {
+    int slots = numFiles > 0 ? numFiles : 1;
+
+    catalogue->numFiles = numFiles;
+    catalogue->mapped = emalloc(slots * sizeof(MappedFile));
+    catalogue->schemas = emalloc(slots * sizeof(Schema));
+    memset(catalogue->mapped, 0, slots * sizeof(MappedFile));
+    memset(catalogue->schemas, 0, slots * sizeof(Schema));
+    memset(&catalogue->job, 0, sizeof(IngestJob));
+    catalogue->job.values = values;
+    pthread_mutex_init(&catalogue->job.lock, NULL);
+    int ok = 1;
+    for (int i = 0; i < numFiles; i++) {
+        MappedFile* mapped = &catalogue->mapped[i];
+        int columns[MAX_VALUE_COLUMNS];
+        if (mapSnapshot(files[i], values, mapped, columns)) {
+            addSnapshotUnits(mapped, values->count, columns, &catalogue->job.units, &catalogue->job.numUnits);
+            continue;
+        }
+        if (!mapFileForReading(files[i], mapped)) {
+            continue;
+        }
+        const char* cursor = mapped->data;
+        StrView header;
+        if (!nextLine(&cursor, mapped->data + mapped->size, &header)) {
+            continue;
+        }
+        if (!resolveSchema(header, values, files[i], &catalogue->schemas[i])) {
+            ok = 0;
             continue;
         }
+        splitIntoUnits(mapped, &catalogue->schemas[i], values->count, &catalogue->job.units, &catalogue->job.numUnits);
+    }
+    return ok;
+}
+
+/**
+ * Function: catalogue_ingest
+ * --------------------------
+ * @brief Parses every unit of the catalogue with `threads` workers and keeps the best rows in `heap`.
+ *
+ * Each worker runs the top-N pass over the --sortBy column of the units it parsed, and the per-worker
+ * survivors are merged into `heap`. A heap of capacity 0 only loads the rows.
+ *
+ * @param catalogue A pointer to an open catalogue.
+ * @param threads The number of ingest threads to use. There are never more threads than units.
+ * @param heap An initialized heap that receives the best rows of the whole catalogue.
+ *
+ * @return int The number of ingest threads that ran.
+ */
+int catalogue_ingest(Catalogue* catalogue, int threads, TopK* heap) {
+    if (threads > catalogue->job.numUnits) {
+        threads = catalogue->job.numUnits;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    // threads drops to the number actually started if one fails to start; every worker's heap is still freed
+    int numWorkers = threads;
+    IngestWorker* workers = emalloc(numWorkers * sizeof(IngestWorker));
+    for (int t = 0; t < numWorkers; t++) {
+        workers[t].job = &catalogue->job;
+        topk_init(&workers[t].heap, heap->capacity);
+    }
+    for (int t = 1; t < numWorkers; t++) {
+        if (pthread_create(&workers[t].thread, NULL, ingestWorker, &workers[t]) != 0) {
+            fprintf(stderr, "Failed to start ingest thread %d.\n", t);
+            threads = t;
+            break;
+        }
+    }
+    ingestWorker(&workers[0]);
+    for (int t = 1; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        stats_add(&workers[t].stats);
+    }
+
+    StatsMark mark = stats_now();
+    for (int t = 0; t < numWorkers; t++) {
+        for (int i = 0; i < workers[t].heap.size; i++) {
+            topk_push(heap, &workers[t].heap.entries[i]);
+        }
+        free(workers[t].heap.entries);
+    }
+    free(workers);
+    stats_stage(STAGE_MERGE, &mark);
+    return threads;
+}
+
+/**
+ * Function: catalogue_close
+ * -------------------------
+ * @brief Releases the unit tables of a catalogue and unmaps its files and snapshots.
+ *
+ * @return nothing
+ */
+void catalogue_close(Catalogue* catalogue) {
+    for (int u = 0; u < catalogue->job.numUnits; u++) {
+        if (!catalogue->job.units[u].preloaded) {
+            song_table_free(&catalogue->job.units[u].table);
+        }
+    }
+    free(catalogue->job.units);
+    pthread_mutex_destroy(&catalogue->job.lock);
+    for (int i = 0; i < catalogue->numFiles; i++) {
+        unmapFile(&catalogue->mapped[i]);
+        free(catalogue->schemas[i].roles);
+    }
+    free(catalogue->mapped);
+    free(catalogue->schemas);
+    memset(catalogue, 0, sizeof(Catalogue));
+}
+
+/**
+ * Function: catalogue_tables
+ * --------------------------
+ * @brief Collects the unit tables of an ingested catalogue into one array indexed by unit.
+ *
+ * The tables are shallow copies; they stay valid until the catalogue is closed.
+ *
+ * @return SongTable* The tables, to be released with free.
+ */
+SongTable* catalogue_tables(const Catalogue* catalogue) {
+    int numUnits = catalogue->job.numUnits;
+    SongTable* tables = emalloc((numUnits > 0 ? numUnits : 1) * sizeof(SongTable));
+
+    for (int u = 0; u < numUnits; u++) {
+        tables[u] = catalogue->job.units[u].table;
+    }
+    return tables;
+}
+
+/**
+ * Function: catalogue_rows
+ * ------------------------
+ * @brief Lists the rows of an ingested catalogue in input order, for sort_rows.
+ *
+ * Parsed units only hold rows that passed the filters of `values` already; the rows of preloaded units are
+ * checked against them here.
+ *
+ * @param count Receives the number of rows listed.
+ *
+ * @return SortedRow* The rows, to be released with free.
+ */
+SortedRow* catalogue_rows(const Catalogue* catalogue, const ValueColumns* values, size_t* count) {
+    size_t total = 0;
+
+    for (int u = 0; u < catalogue->job.numUnits; u++) {
+        total += catalogue->job.units[u].table.rows;
+    }
+    SortedRow* rows = emalloc((total > 0 ? total : 1) * sizeof(SortedRow));
+    STATS_ALLOCATION((total > 0 ? total : 1) * sizeof(SortedRow));
+    *count = 0;
+    for (int u = 0; u < catalogue->job.numUnits; u++) {
+        const IngestUnit* unit = &catalogue->job.units[u];
+        for (size_t row = 0; row < unit->table.rows; row++) {
+            int rejected = 0;
+            for (int v = 0; unit->preloaded && v < values->count && !rejected; v++) {
+                rejected = valueRejected(values, v, unit->table.values[v][row]);
+            }
+            if (!rejected) {
+                rows[*count].table = u;
+                rows[*count].row = (unsigned int)row;
+                (*count)++;
+            }
+        }
+    }
+    return rows;
+}
+
+/**
+ * Function: writeSnapshotArray
+ * ----------------------------
+ * @brief Writes one 4-byte column of every unit table of a catalogue, in input order.
+ *
+ * @param role The column to write: the artist or song lengths for FIELD_ARTIST or FIELD_SONG, the years for
+ * FIELD_YEAR, and value column `role` otherwise.
+ *
+ * @return int 1 if everything was written, 0 otherwise.
+ */
+int writeSnapshotArray(FILE* out, const Catalogue* catalogue, int role) {
+    for (int u = 0; u < catalogue->job.numUnits; u++) {
+        const SongTable* table = &catalogue->job.units[u].table;
+        const void* column = role >= 0 ? (const void*)table->values[role] :
+                             role == FIELD_ARTIST ? (const void*)table->artist_len :
+                             role == FIELD_SONG ? (const void*)table->song_len : (const void*)table->year;
+        if (table->rows > 0 && fwrite(column, 4, table->rows, out) != table->rows) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Function: buildSnapshot
+ * -----------------------
+ * @brief Parses a CSV file with every numeric column and writes its snapshot, unless a valid one exists.
+ *
+ * The columns are those of the header other than artist, song and year. The snapshot is written to a
+ * temporary file first and renamed over the old one, so readers never see half of it. The size and time of
+ * the CSV file are taken before it is parsed, so a file that changes meanwhile gets a snapshot that is
+ * already stale rather than one that is wrong.
+ *
+ * @param filename The name of the CSV file.
+ * @param threads The number of ingest threads to parse with.
+ *
+ * @return int 1 if the file has a valid snapshot afterwards, 0 otherwise.
+ */
+int buildSnapshot(const char* filename, int threads) {
+    MappedFile existing;
+    if (mapSnapshot(filename, NULL, &existing, NULL)) {
+        unmapFile(&existing);
+        return 1;
+    }
+
+    struct stat csv;
+    MappedFile mapped;
+    if (stat(filename, &csv) != 0 || !mapFileForReading(filename, &mapped)) {
+        return 0;
+    }
+    ValueColumns values;
+    char* names[MAX_VALUE_COLUMNS] = { NULL };
+    const char* cursor = mapped.data;
+    StrView header, firstRow;
+    values.count = 0;
+    if (nextLine(&cursor, mapped.data + mapped.size, &header)) {
+        int hasRow = nextLine(&cursor, mapped.data + mapped.size, &firstRow);
+        discoverValueColumns(header, hasRow ? &firstRow : NULL, &values, names);
+    }
+    unmapFile(&mapped);
+    for (int v = 0; v < values.count; v++) {
+        if (strlen(values.names[v]) >= SNAPSHOT_NAME_SIZE) {
+            fprintf(stderr, "Column name %s is too long for a snapshot, leaving it out.\n", values.names[v]);
+            memmove(&values.names[v], &values.names[v + 1], (values.count - v - 1) * sizeof(const char*));
+            values.count--;
+            v--;
+        }
+    }
+
+    Catalogue catalogue;
+    TopK none;
+    catalogue_open(&catalogue, (char**)&filename, 1, &values);
+    topk_init(&none, 0);
+    catalogue_ingest(&catalogue, threads, &none);
+    StatsMark mark = stats_now();
+
+    SnapshotHeader snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    memcpy(snapshot.magic, SNAPSHOT_MAGIC, sizeof(snapshot.magic));
+    snapshot.size = (long long)csv.st_size;
+    snapshot.mtimeSec = (long long)csv.st_mtim.tv_sec;
+    snapshot.mtimeNsec = (long long)csv.st_mtim.tv_nsec;
+    snapshot.numColumns = values.count;
+    snapshot.offsetSize = (int)sizeof(size_t);
+    for (int u = 0; u < catalogue.job.numUnits; u++) {
+        const SongTable* table = &catalogue.job.units[u].table;
+        snapshot.rows += (long long)table->rows;
+        for (size_t row = 0; row < table->rows; row++) {
+            snapshot.textSize += (long long)table->artist_len[row] + table->song_len[row];
+        }
+    }
+
+    char* name = snapshotFileName(filename);
+    char* tempName = emalloc(strlen(name) + 5);
+    strcpy(tempName, name);
+    strcat(tempName, ".tmp");
+    FILE* out = fopen(tempName, "wb");
+    int ok = out != NULL && fwrite(&snapshot, sizeof(snapshot), 1, out) == 1;
+    for (int v = 0; ok && v < values.count; v++) {
+        char column[SNAPSHOT_NAME_SIZE] = { 0 };
+        strcpy(column, values.names[v]);
+        ok = fwrite(column, sizeof(column), 1, out) == 1;
+    }
+    // the artist and song of every row are laid out one after the other in the string heap
+    for (int pass = 0; pass < 2 && ok; pass++) {
+        size_t offset = 0;
+        for (int u = 0; ok && u < catalogue.job.numUnits; u++) {
+            const SongTable* table = &catalogue.job.units[u].table;
+            for (size_t row = 0; ok && row < table->rows; row++) {
+                size_t position = offset + (pass == 0 ? 0 : table->artist_len[row]);
+                ok = fwrite(&position, sizeof(size_t), 1, out) == 1;
+                offset += table->artist_len[row] + table->song_len[row];
+            }
+        }
+    }
+    ok = ok && writeSnapshotArray(out, &catalogue, FIELD_ARTIST) && writeSnapshotArray(out, &catalogue, FIELD_SONG) &&
+         writeSnapshotArray(out, &catalogue, FIELD_YEAR);
+    for (int v = 0; ok && v < values.count; v++) {
+        ok = writeSnapshotArray(out, &catalogue, v);
+    }
+    for (int u = 0; ok && u < catalogue.job.numUnits; u++) {
+        const SongTable* table = &catalogue.job.units[u].table;
+        for (size_t row = 0; ok && row < table->rows; row++) {
+            ok = fwrite(table->text + table->artist_off[row], 1, table->artist_len[row], out) == table->artist_len[row] &&
+                 fwrite(table->text + table->song_off[row], 1, table->song_len[row], out) == table->song_len[row];
+        }
+    }
+    if (out != NULL && fclose(out) != 0) {
+        ok = 0;
+    }
+    if (ok && rename(tempName, name) != 0) {
+        ok = 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to write snapshot %s.\n", name);
+        remove(tempName);
+    }
+    free(tempName);
+    free(name);
+    catalogue_close(&catalogue);
+    for (int v = 0; v < MAX_VALUE_COLUMNS; v++) {
+        free(names[v]);
+    }
+    stats_stage(STAGE_SNAPSHOT, &mark);
+    return ok;
+}
+
+/**
+ * Function: extractDataFromCSV
+ * ---------------------------
+ * @brief Extracts data from CSV files and populates a linked list with song information.
+ *
+ * Every file is mapped and its header resolved into a Schema, so columns are found by name and --sortBy can
+ * be any list of keys (see SortSpec). --energy and --danceability become minimum thresholds that the row
+ * parser applies before a row is stored. The rows are split into units that `threads` workers parse into
+ * their own column tables. When --sortBy is a single descending numeric column, each worker runs the top-N
+ * pass over that column of its tables, and the per-worker survivors are merged into the final `display` best
+ * rows. Any other spec is answered by sort_rows over the loaded rows once every unit is parsed. Only the rows
+ * that make the cut are turned into list nodes. --snapshot first writes a snapshot of every file that has no
+ * valid one; files with a valid snapshot are answered from it without being parsed.
+ *
+ * @param options The Options struct containing configuration settings for the data extraction.
+ * @param list A pointer to the head of the linked list, where the extracted data will be stored.
+ * @param arena The arena that owns the nodes of the list.
+ *
+ * @return int 1 if the output was written, 0 if --sortBy is missing or names a column a file lacks.
+ */
+int extractDataFromCSV(Options options, node_t** list, Arena* arena) {
+    SortSpec spec;
+    if (options.sortBy == NULL) {
+        fprintf(stderr, "Missing --sortBy column.\n");
+        return 0;
+    }
+    if (!sort_spec_parse(options.sortBy, &spec)) {
+        fprintf(stderr, "Invalid --sortBy spec %s.\n", options.sortBy);
+        return 0;
+    }
+
+    ValueColumns values;
+    values.count = 0;
+    int unresolved = sort_spec_resolve(&spec, &values, 1);
+    if (unresolved >= 0) {
+        fprintf(stderr, "Too many columns to sort by %s.\n", spec.names[unresolved]);
+        sort_spec_free(&spec);
+        return 0;
+    }
+    int topN = spec.numKeys == 1 && spec.roles[0] >= 0 && spec.descending[0];
+    if (options.energy > 0) {
+        addRangeFilter(&values, "energy", options.energy, INFINITY);
+    }
+    if (options.danceability > 0) {
+        addRangeFilter(&values, "danceability", options.danceability, INFINITY);
+    }
+
+    StatsMark start = stats_now();
+    StatsMark mark = start;
+    for (int i = 0; options.snapshot && i < options.numFiles; i++) {
+        buildSnapshot(options.files[i], options.threads);
+    }
+    Catalogue catalogue;
+    // a file that lacks a column makes the whole run fail rather than leave its songs out of the output
+    if (!catalogue_open(&catalogue, options.files, options.numFiles, &values)) {
+        catalogue_close(&catalogue);
+        sort_spec_free(&spec);
+        return 0;
+    }
+    stats_stage(STAGE_MAP, &mark);
+
+    TopK heap;
+    topk_init(&heap, topN ? options.display : 0);
+    int threads = catalogue_ingest(&catalogue, options.threads, &heap);
+    mark = stats_now();
+
+    SongTable* tables = catalogue_tables(&catalogue);
+    if (topN) {
+        *list = topk_to_list(&heap, tables, arena);
+    } else {
+        size_t count;
+        SortedRow* rows = catalogue_rows(&catalogue, &values, &count);
+        count = sort_rows(&spec, tables, rows, count, options.display > 0 ? (size_t)options.display : 0);
+        stats_stage(STAGE_SORT, &mark);
+        node_t** tail = list;
+        for (size_t i = 0; i < count; i++) {
+            const SongTable* table = &tables[rows[i].table];
+            *tail = createRowNode(arena, table, rows[i].row, sort_spec_value(&spec, table, rows[i].row));
+            tail = &(*tail)->next;
+        }
+        free(rows);
+    }
+    free(tables);
+    stats_stage(STAGE_MATERIALIZE, &mark);
+    catalogue_close(&catalogue);
+    stats_stage(STAGE_MAP, &mark);
+    print_next_nodes(*list, options.display, options, sort_spec_column(&spec));
+    stats_stage(STAGE_OUTPUT, &mark);
+    if (options.stats != NULL) {
+        stats_report(options.stats, threads, start);
+    }
+    sort_spec_free(&spec);
+    return 1;
+}
+
+/**
+ * @brief The longest request line the daemon reads from a client.
+ */
+#define MAX_REQUEST_LENGTH 4096
+
+/**
+ * @brief The most arguments a request line can hold.
+ */
+#define MAX_REQUEST_ARGS 64
+
+/**
+ * @brief How long the daemon waits for a client to send its request, in seconds.
+ */
+#define REQUEST_TIMEOUT 1
+
+/**
+ * @brief How long the daemon spends sending one reply, in seconds. A client that stops reading, or reads too
+ * slowly, loses the rest of its reply instead of holding up the clients behind it.
+ */
+#define REPLY_TIMEOUT 5
+
+/**
+ * @brief The changes in the directory of a served file that make the daemon check whether it must reload.
+ *
+ * Writes are only picked up once the writer closes the file, so a file is never loaded half-written.
+ */
+#define RELOAD_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_ATTRIB)
 
-        char line[MAX_LINE_LEN];
-        fgets(line, sizeof(line), file);
+/**
+ * @brief The number of sort orders the daemon keeps; the oldest is dropped to make room for a new one.
+ */
+#define RESIDENT_ORDERS 16
 
-        while (fgets(line, sizeof(line), file) != NULL) {
-            char* artist;  
-            char* song;
-            int year;
-            float sorting;
+/**
+ * @brief What a served file was when it was loaded, to tell whether it changed since.
+ */
+typedef struct {
+    int exists;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+} FileIdentity;
 
-            parseLine(line, &artist, &song, &year, &sorting, &options);
-            node_t* new_node = createNode(artist, song, year, sorting);
-            *list = add_inorder(*list, new_node);
+/**
+ * @brief A catalogue held in memory by the daemon, with every numeric column of its files loaded.
+ *
+ * The value columns are those of the first file's header other than artist, song and year; no filter is
+ * applied while loading, queries apply their own. `tables[u]` is the table of unit `u`. `orders[o]` lists
+ * every row in the order of the --sortBy spec `orderSpecs[o]`, written as sort_spec_format writes it; an order
+ * is built by the first query with its spec and kept until a reload or until RESIDENT_ORDERS newer specs were
+ * asked for.
+ */
+typedef struct {
+    Catalogue catalogue;
+    ValueColumns values;
+    char* names[MAX_VALUE_COLUMNS];
+    SongTable* tables;
+    size_t numRows;
+    char* orderSpecs[RESIDENT_ORDERS];
+    SortedRow* orders[RESIDENT_ORDERS];
+    int nextOrder;
+    int numFiles;
+    FileIdentity* identities;
+} ResidentCatalogue;
 
-            free(artist);  
-            free(song);   
-        }
+/**
+ * Function: free_options
+ * ----------------------
+ * @brief Releases the strings of an Options struct.
+ *
+ * @return nothing
+ */
+void free_options(Options* options) {
+    free(options->sortBy);
+    free(options->output);
+    free(options->stats);
+    free(options->serve);
+    for (int i = 0; i < options->numFiles; i++) {
+        free(options->files[i]);
+    }
+    free(options->files);
+}
 
-        fclose(file);
+/**
+ * Function: identify_file
+ * -----------------------
+ * @brief Records the identity of a file as it is now.
+ *
+ * @return nothing
+ */
+void identify_file(const char* path, FileIdentity* identity) {
+    struct stat st;
+
+    memset(identity, 0, sizeof(FileIdentity));
+    if (stat(path, &st) == 0) {
+        identity->exists = 1;
+        identity->dev = st.st_dev;
+        identity->ino = st.st_ino;
+        identity->size = st.st_size;
+        identity->mtime = st.st_mtim;
     }
+}
 
-    print_next_nodes(*list, options.display, options);
+/**
+ * Function: resident_free
+ * -----------------------
+ * @brief Closes the catalogue of a ResidentCatalogue and releases it.
+ *
+ * @return nothing
+ */
+void resident_free(ResidentCatalogue* resident) {
+    catalogue_close(&resident->catalogue);
+    for (int v = 0; v < MAX_VALUE_COLUMNS; v++) {
+        free(resident->names[v]);
+    }
+    for (int o = 0; o < RESIDENT_ORDERS; o++) {
+        free(resident->orderSpecs[o]);
+        free(resident->orders[o]);
+    }
+    free(resident->tables);
+    free(resident->identities);
+    free(resident);
 }
-  
 
 /**
- * @brief The main function and entry point of the program.
+ * Function: resident_load
+ * -----------------------
+ * @brief Loads the files of the daemon into memory with `threads` ingest threads.
  *
- * @param argc The number of arguments passed to the program.
- * @param argv The list of arguments passed to the program.
- * @return int 0: No errors; 1: Errors produced.
+ * The identity of every file is taken before it is mapped, so a change made while loading is seen as a
+ * change afterwards and causes another reload.
  *
+ * @return ResidentCatalogue* The loaded catalogue, or NULL if it holds more rows than a row number can count.
  */
-int main(int argc, char* argv[]) {
-    node_t* list = NULL;
-    Options options = parse_arguments(argc, argv);
-    extractDataFromCSV(options, &list);
-    
-    free(options.sortBy);
-    for (int i = 0; i < options.numFiles; i++) {
-        free(options.files[i]);
+ResidentCatalogue* resident_load(char** files, int numFiles, int threads) {
+    ResidentCatalogue* resident = emalloc(sizeof(ResidentCatalogue));
+
+    memset(resident, 0, sizeof(ResidentCatalogue));
+    resident->numFiles = numFiles;
+    resident->identities = emalloc((numFiles > 0 ? numFiles : 1) * sizeof(FileIdentity));
+    for (int i = 0; i < numFiles; i++) {
+        identify_file(files[i], &resident->identities[i]);
+    }
+    for (int i = 0; i < numFiles; i++) {
+        MappedFile mapped;
+        if (mapFileForReading(files[i], &mapped)) {
+            const char* cursor = mapped.data;
+            StrView header, firstRow;
+            int found = nextLine(&cursor, mapped.data + mapped.size, &header);
+            if (found) {
+                int hasRow = nextLine(&cursor, mapped.data + mapped.size, &firstRow);
+                discoverValueColumns(header, hasRow ? &firstRow : NULL, &resident->values, resident->names);
+            }
+            unmapFile(&mapped);
+            if (found) {
+                break;
+            }
+        }
     }
-    free(options.files);
 
-    exit(0);
+    catalogue_open(&resident->catalogue, files, numFiles, &resident->values);
+    TopK none;
+    topk_init(&none, 0);
+    catalogue_ingest(&resident->catalogue, threads, &none);
+
+    resident->tables = catalogue_tables(&resident->catalogue);
+    for (int u = 0; u < resident->catalogue.job.numUnits; u++) {
+        resident->numRows += resident->tables[u].rows;
+    }
+    if (resident->numRows > UINT_MAX) {
+        fprintf(stderr, "Too many songs to serve: %zu.\n", resident->numRows);
+        resident_free(resident);
+        return NULL;
+    }
+    return resident;
 }
 
- //parsetwooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooooo(final version)
- /** @file music_manager.c
- *  @brief A small program to analyze songs data.
- *  @author Mike Z.
- *  @author Felipe R.
- *  @author Hausi M.
- *  @author Jose O.
- *  @author Victoria L.
- *  @author Dorsa Peikani
+/**
+ * Function: resident_changed
+ * --------------------------
+ * @brief Tells whether any file of a loaded catalogue changed since it was loaded.
  *
+ * @return int 1 if a file was written, replaced, created or removed, 0 otherwise.
  */
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include "list.h"
-#include "list.c"
+int resident_changed(const ResidentCatalogue* resident, char** files) {
+    for (int i = 0; i < resident->numFiles; i++) {
+        FileIdentity now;
+        const FileIdentity* then = &resident->identities[i];
+        identify_file(files[i], &now);
+        if (now.exists != then->exists || now.dev != then->dev || now.ino != then->ino || now.size != then->size ||
+            now.mtime.tv_sec != then->mtime.tv_sec || now.mtime.tv_nsec != then->mtime.tv_nsec) {
+            return 1;
+        }
+    }
+    return 0;
+}
 
-#define MAX_LINE_LEN 180
- 
 /**
- * @brief An struct that encapsulates program arguments such as sorting, display preferences, file names, and numerical parameters like energy and danceability.
+ * Function: sort_spec_format
+ * --------------------------
+ * @brief Writes a spec with the direction of every key spelled out, so equal orders are written the same.
+ *
+ * @return char* The spec, to be released with free.
  */
-typedef struct {
-    char* sortBy;
-    int display;
-    char** files;
-    int numFiles;
-    float energy;          
-    float danceability;    
-} Options;
+char* sort_spec_format(const SortSpec* spec) {
+    size_t size = 1;
+    for (int k = 0; k < spec->numKeys; k++) {
+        size += strlen(spec->names[k]) + sizeof(":desc,");
+    }
+    char* text = emalloc(size);
+    size_t len = 0;
+    for (int k = 0; k < spec->numKeys; k++) {
+        len += (size_t)snprintf(text + len, size - len, "%s%s:%s", k > 0 ? "," : "", spec->names[k],
+                                spec->descending[k] ? "desc" : "asc");
+    }
+    text[len] = '\0';
+    return text;
+}
 
 /**
- * Function: parse_files
- * ---------------------
- * @brief Parses command-line arguments to extract file names.
+ * Function: resident_order
+ * ------------------------
+ * @brief Returns every row of a loaded catalogue in the order of a resolved spec, building it once.
  *
- * @param argc The number of command-line arguments.
- * @param argv An array of strings containing the command-line arguments.
- * @param numFiles A pointer to an integer, used to store the count of files found.
+ * The order is the one a run over the files produces: sort_rows over all rows, ties in input order.
  *
- * @return char** An array of strings containing the extracted file names, or NULL if the "--files" option is not found.
- */ 
-char** parse_files(int argc, char* argv[], int* numFiles) {
-    char** files = NULL;
-    *numFiles = 0;
-
-    for (int i = 1; i < argc; i++) {
-        if (strncmp(argv[i], "--files=", 8) == 0) {
-            char* filesArg = strdup(argv[i] + 8);
-            char* token = strtok(filesArg, ",");
-            while (token != NULL) {
-                files = realloc(files, (*numFiles + 1) * sizeof(char*));
-                files[*numFiles] = strdup(token);
-                (*numFiles)++;
-                token = strtok(NULL, ",");
-            }
-            free(filesArg);
-            return files;
+ * @return const SortedRow* The rows in order, `numRows` of them.
+ */
+const SortedRow* resident_order(ResidentCatalogue* resident, const SortSpec* spec) {
+    char* text = sort_spec_format(spec);
+    for (int o = 0; o < RESIDENT_ORDERS; o++) {
+        if (resident->orderSpecs[o] != NULL && strcmp(resident->orderSpecs[o], text) == 0) {
+            free(text);
+            return resident->orders[o];
         }
     }
 
-    return NULL;  
+    size_t count;
+    SortedRow* rows = catalogue_rows(&resident->catalogue, &resident->values, &count);
+    sort_rows(spec, resident->tables, rows, count, count);
+    int o = resident->nextOrder;
+    resident->nextOrder = (o + 1) % RESIDENT_ORDERS;
+    free(resident->orderSpecs[o]);
+    free(resident->orders[o]);
+    resident->orderSpecs[o] = text;
+    resident->orders[o] = rows;
+    return rows;
 }
 
 /**
- * Function: parse_arguments
- * -------------------------
- * @brief Parses command-line arguments and populates an Options struct with the parsed values.
+ * Function: resident_query
+ * ------------------------
+ * @brief Answers a query from a loaded catalogue with the same songs, in the same order, as a run over its files.
  *
- * @param argc The number of command-line arguments.
- * @param argv An array of strings containing the command-line arguments.
+ * The rows are walked in the order of the --sortBy spec, skipping those outside the --energy and
+ * --danceability thresholds, until `display` songs are found. Only those songs are copied into the arena.
  *
- * @return Options The Options struct populated with the parsed values.
+ * @param resident The loaded catalogue.
+ * @param query The options of the query. Only --display, --energy and --danceability are used.
+ * @param spec The parsed --sortBy spec of the query. It is resolved against the served columns.
+ * @param arena The arena that owns the nodes of the returned list.
+ * @param list Receives the head of the list of songs, NULL if there are none.
+ * @param missing Receives the name of the column the served files lack when the query cannot be answered.
+ *
+ * @return int 1 if the query was answered, 0 if it names a column the served files do not have.
  */
-Options parse_arguments(int argc, char* argv[]) {
-    Options options;
-    options.sortBy = NULL;
-    options.display = 0;
-    options.files = NULL;
-    options.numFiles = 0;
-    options.energy = 0.0;          
-    options.danceability = 0.0;      
+int resident_query(ResidentCatalogue* resident, const Options* query, SortSpec* spec, Arena* arena, node_t** list,
+                   const char** missing) {
+    ValueColumns ranges = resident->values;
+    int filtered[MAX_VALUE_COLUMNS];
+    int numFiltered = 0;
+    int unresolved = sort_spec_resolve(spec, &ranges, 0);
+
+    *list = NULL;
+    if (unresolved >= 0) {
+        *missing = spec->names[unresolved];
+        return 0;
+    }
+    if (query->energy > 0 || query->danceability > 0) {
+        const char* names[2] = { "energy", "danceability" };
+        float minimums[2] = { query->energy, query->danceability };
+        for (int f = 0; f < 2; f++) {
+            if (minimums[f] <= 0) {
+                continue;
+            }
+            int v = findValueColumn(&ranges, names[f]);
+            if (v < 0) {
+                *missing = names[f];
+                return 0;
+            }
+            ranges.min[v] = minimums[f];
+            filtered[numFiltered++] = v;
+        }
+    }
 
-    for (int i = 1; i < argc; i++) {
-        if (strncmp(argv[i], "--sortBy=", 9) == 0) {
-            options.sortBy = strdup(argv[i] + 9);
-        } else if (strncmp(argv[i], "--display=", 10) == 0) {
-            options.display = atoi(argv[i] + 10);
-        } else if (strncmp(argv[i], "--energy=", 9) == 0) {
-            options.energy = atof(argv[i] + 9);
-        } else if (strncmp(argv[i], "--danceability=", 15) == 0) {
-            options.danceability = atof(argv[i] + 15);
+    const SortedRow* order = resident_order(resident, spec);
+    node_t* tail = NULL;
+    int count = 0;
+    for (size_t i = 0; i < resident->numRows && count < query->display; i++) {
+        const SongTable* table = &resident->tables[order[i].table];
+        size_t row = order[i].row;
+        int rejected = 0;
+        for (int f = 0; f < numFiltered && !rejected; f++) {
+            rejected = valueRejected(&ranges, filtered[f], table->values[filtered[f]][row]);
+        }
+        if (rejected) {
+            continue;
         }
+        node_t* node = createRowNode(arena, table, row, sort_spec_value(spec, table, row));
+        if (tail == NULL) {
+            *list = node;
+        } else {
+            tail->next = node;
+        }
+        tail = node;
+        count++;
     }
-    options.files = parse_files(argc, argv, &options.numFiles);
+    return 1;
+}
 
-    return options;
+/**
+ * Function: reply_error
+ * ---------------------
+ * @brief Writes the error line that answers a request the daemon cannot answer: "error: " and the message.
+ *
+ * @return nothing
+ */
+void reply_error(OutputBuffer* out, const char* message, const char* subject) {
+    output_write(out, "error: ", 7);
+    output_write(out, message, strlen(message));
+    output_write(out, subject, strlen(subject));
+    output_write(out, "\n", 1);
 }
 
 /**
- * Function: print_next_nodes
- * --------------------------
- * @brief Prints a specified number of next nodes from the linked list and writes the data to a CSV file.
+ * Function: serve_request
+ * -----------------------
+ * @brief Reads one request from a client, answers it and closes the connection.
+ *
+ * A request is one line of arguments separated by blanks, written the way they are given on the command line,
+ * for example "--sortBy=energy --display=10 --danceability=0.5". The answer is the CSV the same run would
+ * write to --output. A request that cannot be answered gets a single line starting with "error: " instead.
  *
- * @param list A pointer to the head of the linked list.
- * @param display The number of nodes to display and write to the CSV file.
- * @param options The Options struct containing configuration settings.
  * @return nothing
  */
-void print_next_nodes(node_t* list, int display, Options options) {
-    node_t* current = list;
-    int count = 0;
+void serve_request(ResidentCatalogue* resident, int client) {
+    char request[MAX_REQUEST_LENGTH];
+    size_t length = 0;
+    struct timeval receiveTimeout = { REQUEST_TIMEOUT, 0 };
+    struct timeval sendTimeout = { REPLY_TIMEOUT, 0 };
+
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &receiveTimeout, sizeof(receiveTimeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+    while (length < sizeof(request) - 1 && memchr(request, '\n', length) == NULL) {
+        ssize_t n = read(client, request + length, sizeof(request) - 1 - length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        length += (size_t)n;
+    }
+    request[length] = '\0';
 
-    FILE* output_file = fopen("output.csv", "w");
-    if (output_file == NULL) {
-        printf("Failed to open output.csv for writing.\n");
-        return;
+    char* argv[MAX_REQUEST_ARGS + 1];
+    int argc = 0;
+    argv[argc++] = "music_manager";
+    for (char* token = strtok(request, " \t\r\n"); token != NULL && argc < MAX_REQUEST_ARGS; token = strtok(NULL, " \t\r\n")) {
+        argv[argc++] = token;
     }
-    fprintf(output_file, "artist,song,year,%s\n", options.sortBy);
-    while (current != NULL && count < display) {
-        fprintf(output_file, "%s,%s,%d,%g\n", current->artist, current->song, current->year, current->sorting);
-        current = current->next;
-        count++;
+    argv[argc] = NULL;
+
+    Options query = parse_arguments(argc, argv);
+    OutputBuffer* out = output_attach(client);
+    out->deadline = stats_now().wall + REPLY_TIMEOUT;
+    SortSpec spec;
+    if (query.sortBy == NULL) {
+        reply_error(out, "missing --sortBy column", "");
+    } else if (!sort_spec_parse(query.sortBy, &spec)) {
+        reply_error(out, "invalid --sortBy spec ", query.sortBy);
+    } else {
+        Arena arena = { NULL };
+        node_t* list;
+        const char* missing;
+        if (resident_query(resident, &query, &spec, &arena, &list, &missing)) {
+            write_nodes(out, list, query.display, sort_spec_column(&spec));
+        } else {
+            reply_error(out, "the served files have no column ", missing);
+        }
+        arena_free(&arena);
+        sort_spec_free(&spec);
     }
-    free(options.sortBy);
-    for (int i = 0; i < options.numFiles; i++) {
-        free(options.files[i]);
+    output_close(out);
+    free_options(&query);
+}
+
+/**
+ * Function: open_socket
+ * ---------------------
+ * @brief Creates the listening Unix domain socket of the daemon.
+ *
+ * A socket left behind by a daemon that is gone is replaced; a path that is in use, or is not a socket, is not.
+ *
+ * @return int The listening socket, or -1 if it could not be created.
+ */
+int open_socket(const char* path) {
+    struct sockaddr_un address;
+    struct stat st;
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long.\n", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    if (lstat(path, &st) == 0) {
+        int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+        int live = S_ISSOCK(st.st_mode) && probe >= 0 && connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0;
+        if (probe >= 0) {
+            close(probe);
+        }
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "%s exists and is not a socket.\n", path);
+            return -1;
+        }
+        if (live) {
+            fprintf(stderr, "%s is already in use.\n", path);
+            return -1;
+        }
+        unlink(path);
     }
-    free(options.files);
 
-    fclose(output_file);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
 }
 
 /**
- * Function: openFileForReading
+ * Function: watch_directories
  * ---------------------------
- * @brief Opens a file for reading and returns a pointer to the file stream.
+ * @brief Watches the directory of every served file for changes that can require a reload.
  *
- * @param filename The name of the file to be opened for reading.
+ * Directories are watched rather than the files themselves so that a file that is replaced, or removed and
+ * created again, is still noticed.
  *
- * @return FILE* A pointer to the `FILE` structure representing the file stream if the file was opened successfully,
- *         or NULL if the file could not be opened.
- *
- */ 
-FILE* openFileForReading(const char* filename) {
-    FILE* file = fopen(filename, "r");
-    if (file == NULL) {
-        printf("Failed to open file %s for reading.\n", filename);
+ * @return int 1 if every directory is watched, 0 otherwise.
+ */
+int watch_directories(int notify, char** files, int numFiles) {
+    int ok = 1;
+
+    for (int i = 0; i < numFiles; i++) {
+        char* directory = strdup(files[i]);
+        char* slash = strrchr(directory, '/');
+        if (slash == NULL) {
+            strcpy(directory, ".");
+        } else {
+            slash[slash == directory ? 1 : 0] = '\0';
+        }
+        if (inotify_add_watch(notify, directory, RELOAD_EVENTS) < 0) {
+            fprintf(stderr, "Failed to watch %s for changes.\n", directory);
+            ok = 0;
+        }
+        free(directory);
     }
-    return file;
+    return ok;
 }
 
 /**
- * Function: parseLine
- * -------------------
- * @brief Parses a line of CSV data and extracts relevant song information.
- *
- * @param line The line of CSV data to be parsed.
- * @param artist A pointer to a pointer to store the dynamically allocated memory for the extracted artist name.
- * @param song A pointer to a pointer to store the dynamically allocated memory for the extracted song name.
- * @param year A pointer to an integer to store the extracted year.
- * @param sorting A pointer to a float to store the extracted sorting value.
- * @param options The Options struct containing configuration settings for the data parsing.
+ * @brief A reload of the catalogue running on its own thread while the daemon keeps answering queries.
+ */
+typedef struct {
+    const Options* options;
+    ResidentCatalogue* loaded;
+    int done;
+    pthread_t thread;
+} Reload;
+
+/**
+ * Function: reload_worker
+ * -----------------------
+ * @brief Thread body of a reload: loads the files again and tells the daemon through a pipe when it is done.
  *
- * @return nothing
- */ 
-void parseLine(char* line, char** artist, char** song, int* year, float* sorting, const Options* options) {
-    char* token = strtok(line, ",");
-    int field = 0;
+ * @return void* NULL.
+ */
+void* reload_worker(void* arg) {
+    Reload* reload = arg;
 
-    while (token != NULL) {
-        switch (field) {
-            case 0:
-                *artist = emalloc(strlen(token) + 1);  
-                strcpy(*artist, token);
-                break;
-            case 1:
-                *song = emalloc(strlen(token) + 1);  
-                strcpy(*song, token);
-                break;
-            case 4:
-                *year = atoi(token);
-                break;
-            case 5:
-                if (strcmp(options->sortBy, "popularity") == 0) {
-                    *sorting = atof(token);
-                }
-                break;
-            case 6:
-                if (strcmp(options->sortBy, "danceability") == 0) {
-                    *sorting = atof(token);
-                }
-                break;
-            case 7:
-                if (strcmp(options->sortBy, "energy") == 0) {
-                    *sorting = atof(token);
-                }
-                break;
-        }
-        field++;
-        token = strtok(NULL, ",");
+    reload->loaded = resident_load(reload->options->files, reload->options->numFiles, reload->options->threads);
+    while (write(reload->done, "", 1) < 0 && errno == EINTR) {
     }
+    return NULL;
 }
 
 /**
- * Function: createNode
- * --------------------
- * @brief Creates a new node for the linked list with the provided data.
- *
- * @param artist The artist name to be associated with the new node.
- * @param song The song name to be associated with the new node.
- * @param year The year value to be associated with the new node.
- * @param sorting The sorting value to be associated with the new node.
- *
- * @return node_t* A pointer to the newly created node.
+ * @brief Set by SIGINT and SIGTERM to stop the daemon.
+ */
+volatile sig_atomic_t stopServing = 0;
+
+/**
+ * Function: stop_serving
+ * ----------------------
+ * @brief Signal handler that asks the daemon to stop.
  *
- */ 
-node_t* createNode(const char* artist, const char* song, int year, float sorting) {
-    node_t* new_node = emalloc(sizeof(node_t));
-    new_node->artist = emalloc(strlen(artist) + 1);
-    new_node->song = emalloc(strlen(song) + 1);
-    strcpy(new_node->artist, artist);
-    strcpy(new_node->song, song);
-    new_node->year = year;
-    new_node->sorting = sorting;
-    new_node->next = NULL;
-    return new_node;
+ * @return nothing
+ */
+void stop_serving(int signal) {
+    (void)signal;
+    stopServing = 1;
 }
 
 /**
- * Function: extractDataFromCSV
- * ---------------------------
- * @brief Extracts data from CSV files and populates a linked list with song information.
+ * Function: serve
+ * ---------------
+ * @brief Runs music_manager as a daemon that answers queries over a Unix domain socket.
  *
- * @param options The Options struct containing configuration settings for the data extraction.
- * @param list A pointer to the head of the linked list, where the extracted data will be stored.
+ * The files are loaded into memory once, with every numeric column. Each connection sends one request line and
+ * gets back the CSV of that query, so a query costs a walk over an in-memory order instead of a parse of every
+ * file. When a file changes, the catalogue is reloaded on another thread while queries are still answered from
+ * the old one, which is swapped out once the new one is ready. SIGINT and SIGTERM stop the daemon and remove
+ * the socket.
  *
- * @return nothing
+ * Connections are answered one at a time, in the order they arrive. A client gets REQUEST_TIMEOUT seconds to
+ * send its request and REPLY_TIMEOUT seconds to take its reply, so a client that stalls holds up the ones
+ * behind it for up to about six seconds, but never longer.
+ *
+ * @param options The options of the daemon: --serve, --files and --threads.
+ *
+ * @return int 0 once stopped, 1 if the daemon could not start.
  */
-void extractDataFromCSV(Options options, node_t** list) {
-    for (int i = 0; i < options.numFiles; i++) {
-        FILE* file = openFileForReading(options.files[i]);
-        if (file == NULL) {
+int serve(Options options) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_serving;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = open_socket(options.serve);
+    if (listener < 0) {
+        return 1;
+    }
+    int notify = inotify_init1(IN_NONBLOCK);
+    int done[2];
+    if (notify < 0 || pipe(done) != 0 || !watch_directories(notify, options.files, options.numFiles)) {
+        close(listener);
+        unlink(options.serve);
+        return 1;
+    }
+
+    StatsMark mark = stats_now();
+    ResidentCatalogue* resident = resident_load(options.files, options.numFiles, options.threads);
+    if (resident == NULL) {
+        close(listener);
+        unlink(options.serve);
+        return 1;
+    }
+    fprintf(stderr, "Loaded %zu songs in %.3f s.\n", resident->numRows, stats_now().wall - mark.wall);
+
+    Reload reload;
+    int reloading = 0, pending = 0;
+    reload.options = &options;
+    reload.done = done[1];
+    while (!stopServing) {
+        struct pollfd fds[3] = { { listener, POLLIN, 0 }, { notify, POLLIN, 0 }, { done[0], POLLIN, 0 } };
+        if (poll(fds, 3, -1) < 0) {
             continue;
         }
-
-        char line[MAX_LINE_LEN];
-        fgets(line, sizeof(line), file);
-
-        while (fgets(line, sizeof(line), file) != NULL) {
-            char* artist;  
-            char* song;
-            int year;
-            float sorting;
-
-            parseLine(line, &artist, &song, &year, &sorting, &options);
-            node_t* new_node = createNode(artist, song, year, sorting);
-            *list = add_inorder(*list, new_node);
-
-            free(artist);  
-            free(song);    
+        if (fds[1].revents & POLLIN) {
+            char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            while (read(notify, events, sizeof(events)) > 0) {
+            }
+            pending = 1;
         }
-        fclose(file);
-     
+        if (fds[2].revents & POLLIN) {
+            char byte;
+            if (read(done[0], &byte, 1) == 1) {
+                pthread_join(reload.thread, NULL);
+                reloading = 0;
+                if (reload.loaded != NULL) {
+                    resident_free(resident);
+                    resident = reload.loaded;
+                    fprintf(stderr, "Reloaded %zu songs in %.3f s.\n", resident->numRows, stats_now().wall - mark.wall);
+                }
+            }
+        }
+        if (pending && !reloading) {
+            pending = 0;
+            if (resident_changed(resident, options.files)) {
+                mark = stats_now();
+                reloading = pthread_create(&reload.thread, NULL, reload_worker, &reload) == 0;
+                if (!reloading) {
+                    fprintf(stderr, "Failed to start a reload.\n");
+                }
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            int client = accept(listener, NULL, NULL);
+            if (client >= 0) {
+                serve_request(resident, client);
+            }
+        }
+    }
+
+    if (reloading) {
+        pthread_join(reload.thread, NULL);
+        if (reload.loaded != NULL) {
+            resident_free(reload.loaded);
         }
-    print_next_nodes(*list, options.display, options);
-    
+    }
+    close(listener);
+    unlink(options.serve);
+    close(notify);
+    close(done[0]);
+    close(done[1]);
+    resident_free(resident);
+    return 0;
 }
 
 /**
@@ -784,21 +3781,16 @@ void extractDataFromCSV(Options options, node_t** list) {
  */
 int main(int argc, char* argv[]) {
     node_t* list = NULL;
+    Arena arena = { NULL };
     Options options = parse_arguments(argc, argv);
-    extractDataFromCSV(options, &list);
-    
-    free(options.sortBy);
-    for (int i = 0; i < options.numFiles; i++) {
-        free(options.files[i]);
+    if (options.serve != NULL) {
+        int status = serve(options);
+        free_options(&options);
+        exit(status);
     }
-    free(options.files);
+    int ok = extractDataFromCSV(options, &list, &arena);
+    arena_free(&arena);
+    free_options(&options);
 
-    exit(0);
+    exit(ok ? 0 : 1);
 }
-
- 
-
-  
-
- 
- 
\ No newline at end of file
@@ -0,0 +1,426 @@
+/** @file bench.c
+ *  @brief Throughput benchmark for music_manager (A2.c) and event_manager (A1.c).
+ *
+ *  Generates deterministic synthetic inputs, a song CSV with the column layout music_manager reads and an
+ *  iCalendar file with a configurable number of events and optional line folding, then runs each tool on them
+ *  end to end. Every measurement is written as one JSON object per line so results can be tracked over time:
+ *
+ *      {"stage":"run","tool":"music_manager","case":"energy_top10","rows":1000000,"bytes":...,
+ *       "wall_s":...,"user_s":...,"sys_s":...,"rows_per_s":...,"mb_per_s":...,"peak_rss_kb":...,"exit":0,
+ *       "stats":{"stages":{"parse":{"wall_s":...,"cpu_s":...},...},"counters":{"allocations":...,...}}}
+ *
+ *  "stats" is the --stats report of the tool itself: the time spent in each of its stages and its work and
+ *  allocation counters, or null if the tool did not write one.
+ *
+ *  Usage: bench --music=./music_manager --events=./event_manager [--rows=10000,1000000,10000000]
+ *               [--ics-events=10000,100000,1000000] [--fold] [--repeat=N] [--seed=N] [--dir=DIR]
+ *               [--output=FILE] [--keep]
+ *
+ *  Either tool can be left out to benchmark only the other one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+// the most sizes accepted by --rows and --ics-events
+#define MAX_SIZES 16
+
+// iCalendar lines longer than this many octets are folded when --fold is given
+#define FOLD_LENGTH 75
+
+
+char* musicArg = NULL;
+char* eventsArg = NULL;
+long long rowCounts[MAX_SIZES] = { 10000, 1000000, 10000000 };
+int numRowCounts = 3;
+long long eventCounts[MAX_SIZES] = { 10000, 100000, 1000000 };
+int numEventCounts = 3;
+int foldArg = 0;
+int repeatArg = 1;
+unsigned long long seedArg = 1;
+char* dirArg = "/tmp";
+char* outputArg = NULL;
+int keepArg = 0;
+
+FILE* results = NULL;
+
+// the file every run writes its --stats report to, and the argument that asks for it
+char statsPath[4096];
+char statsOption[4200];
+
+
+// one step of a xorshift64* generator, so the inputs are the same on every machine and every run
+unsigned long long nextRandom(unsigned long long* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+
+// a random integer in [low, high]
+long long randomRange(unsigned long long* state, long long low, long long high) {
+    return low + (long long)(nextRandom(state) % (unsigned long long)(high - low + 1));
+}
+
+
+// a random number in [0, 1)
+double randomUnit(unsigned long long* state) {
+    return (double)(nextRandom(state) >> 11) / 9007199254740992.0;
+}
+
+
+// seconds on a monotonic clock
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// reads a comma-separated list of counts such as 10000,1000000; k and m suffixes multiply by 1000 and 1000000
+int parseCounts(const char* arg, long long* counts) {
+    int n = 0;
+    while (*arg != '\0' && n < MAX_SIZES) {
+        char* end;
+        long long count = strtoll(arg, &end, 10);
+        if (*end == 'k' || *end == 'K') {
+            count *= 1000;
+            end++;
+        } else if (*end == 'm' || *end == 'M') {
+            count *= 1000000;
+            end++;
+        }
+        if (end == arg || count <= 0 || (*end != ',' && *end != '\0')) {
+            fprintf(stderr, "Invalid count list: %s\n", arg);
+            exit(1);
+        }
+        counts[n++] = count;
+        arg = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
+
+// reads the command-line arguments into the globals
+void extractArguments(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--music=", 8) == 0) {
+            musicArg = argv[i] + 8;
+        } else if (strncmp(argv[i], "--events=", 9) == 0) {
+            eventsArg = argv[i] + 9;
+        } else if (strncmp(argv[i], "--rows=", 7) == 0) {
+            numRowCounts = parseCounts(argv[i] + 7, rowCounts);
+        } else if (strncmp(argv[i], "--ics-events=", 13) == 0) {
+            numEventCounts = parseCounts(argv[i] + 13, eventCounts);
+        } else if (strcmp(argv[i], "--fold") == 0) {
+            foldArg = 1;
+        } else if (strncmp(argv[i], "--repeat=", 9) == 0) {
+            repeatArg = atoi(argv[i] + 9) > 0 ? atoi(argv[i] + 9) : 1;
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            seedArg = strtoull(argv[i] + 7, NULL, 10) | 1;
+        } else if (strncmp(argv[i], "--dir=", 6) == 0) {
+            dirArg = argv[i] + 6;
+        } else if (strncmp(argv[i], "--output=", 9) == 0) {
+            outputArg = argv[i] + 9;
+        } else if (strcmp(argv[i], "--keep") == 0) {
+            keepArg = 1;
+        } else {
+            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+}
+
+
+// the genres of the generated songs; as in the real data, a song with several genres has them quoted in one field
+const char* const GENRES[] = { "pop", "rock", "hip hop", "Dance/Electronic", "R&B", "\"pop, rock\"", "\"hip hop, pop\"", "latin" };
+
+
+// writes a song CSV with the header and column layout of the Spotify data music_manager reads
+// about one song in fifty gets a quoted title with a comma in it, so the quoted-field path is exercised too
+long long generateSongs(const char* path, long long rows, unsigned long long seed) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open file %s for writing.\n", path);
+        exit(1);
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+    unsigned long long state = seed;
+
+    fprintf(file, "artist,song,duration_ms,explicit,year,popularity,danceability,energy,key,loudness,mode,"
+                  "speechiness,acousticness,instrumentalness,liveness,valence,tempo,genre\n");
+    for (long long i = 0; i < rows; i++) {
+        long long artist = randomRange(&state, 1, 5000);
+        if (randomRange(&state, 0, 49) == 0) {
+            fprintf(file, "Artist %lld,\"Song %lld, Part %lld\",", artist, i, randomRange(&state, 1, 9));
+        } else {
+            fprintf(file, "Artist %lld,Song %lld,", artist, i);
+        }
+        fprintf(file, "%lld,%s,%lld,%lld,%.3f,%.3f,%lld,%.3f,%lld,%.4f,%.4f,%.6f,%.4f,%.3f,%.3f,%s\n",
+                randomRange(&state, 100000, 400000), randomRange(&state, 0, 3) == 0 ? "True" : "False",
+                randomRange(&state, 1998, 2020), randomRange(&state, 0, 89),
+                randomUnit(&state), randomUnit(&state), randomRange(&state, 0, 11), -20.0 * randomUnit(&state),
+                randomRange(&state, 0, 1), 0.5 * randomUnit(&state), randomUnit(&state), 0.01 * randomUnit(&state),
+                randomUnit(&state), randomUnit(&state), 60.0 + 140.0 * randomUnit(&state),
+                GENRES[randomRange(&state, 0, 7)]);
+    }
+    long long bytes = ftell(file);
+    fclose(file);
+    return bytes;
+}
+
+
+// writes one iCalendar content line, folding it into 75-octet pieces when --fold is given
+void writeContentLine(FILE* file, const char* line) {
+    size_t len = strlen(line);
+    if (!foldArg || len <= FOLD_LENGTH) {
+        fwrite(line, 1, len, file);
+        fputs("\r\n", file);
+        return;
+    }
+    fwrite(line, 1, FOLD_LENGTH, file);
+    fputs("\r\n", file);
+    for (size_t pos = FOLD_LENGTH; pos < len; pos += FOLD_LENGTH - 1) {
+        size_t piece = len - pos < FOLD_LENGTH - 1 ? len - pos : FOLD_LENGTH - 1;
+        fputc(' ', file);
+        fwrite(line + pos, 1, piece, file);
+        fputs("\r\n", file);
+    }
+}
+
+
+// the words the event descriptions are made of
+const char* const WORDS[] = { "review", "planning", "sync", "budget", "design", "release", "retro", "hiring", "roadmap", "demo" };
+
+
+// writes an iCalendar file of single events spread over 2000-2024, in random order, each with the properties
+// a calendar export usually carries; the descriptions are long enough to be folded with --fold
+long long generateCalendar(const char* path, long long events, unsigned long long seed) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open file %s for writing.\n", path);
+        exit(1);
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+    unsigned long long state = seed;
+    char line[512];
+
+    writeContentLine(file, "BEGIN:VCALENDAR");
+    writeContentLine(file, "VERSION:2.0");
+    for (long long i = 0; i < events; i++) {
+        int year = (int)randomRange(&state, 2000, 2024), month = (int)randomRange(&state, 1, 12);
+        int day = (int)randomRange(&state, 1, 28), hour = (int)randomRange(&state, 7, 20);
+        int minute = (int)randomRange(&state, 0, 3) * 15, length = (int)randomRange(&state, 1, 8) * 15;
+        int endHour = hour + (minute + length) / 60, endMinute = (minute + length) % 60;
+
+        writeContentLine(file, "BEGIN:VEVENT");
+        snprintf(line, sizeof(line), "UID:%lld-%llu@bench.example.com", i, nextRandom(&state) % 1000000007ULL);
+        writeContentLine(file, line);
+        writeContentLine(file, "DTSTAMP:20240101T000000Z");
+        snprintf(line, sizeof(line), "DTSTART:%04d%02d%02dT%02d%02d00", year, month, day, hour, minute);
+        writeContentLine(file, line);
+        snprintf(line, sizeof(line), "DTEND:%04d%02d%02dT%02d%02d00", year, month, day, endHour, endMinute);
+        writeContentLine(file, line);
+        snprintf(line, sizeof(line), "SUMMARY:%s %s with team %c", WORDS[randomRange(&state, 0, 9)],
+                 WORDS[randomRange(&state, 0, 9)], (char)('A' + randomRange(&state, 0, 25)));
+        writeContentLine(file, line);
+        snprintf(line, sizeof(line), "LOCATION:Room %lld", randomRange(&state, 100, 999));
+        writeContentLine(file, line);
+
+        int len = snprintf(line, sizeof(line), "DESCRIPTION:");
+        int words = (int)randomRange(&state, 5, 40);
+        for (int w = 0; w < words && len < (int)sizeof(line) - 16; w++) {
+            len += snprintf(line + len, sizeof(line) - len, "%s ", WORDS[randomRange(&state, 0, 9)]);
+        }
+        writeContentLine(file, line);
+        writeContentLine(file, "END:VEVENT");
+    }
+    writeContentLine(file, "END:VCALENDAR");
+    long long bytes = ftell(file);
+    fclose(file);
+    return bytes;
+}
+
+
+// prints the JSON line of a generated input
+void reportInput(const char* kind, const char* path, long long rows, long long bytes, double seconds) {
+    fprintf(results, "{\"stage\":\"generate\",\"input\":\"%s\",\"path\":\"%s\",\"rows\":%lld,\"bytes\":%lld,"
+                     "\"wall_s\":%.6f,\"mb_per_s\":%.3f}\n",
+            kind, path, rows, bytes, seconds, seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+    fflush(results);
+}
+
+
+// reads the --stats report of the last run without its line break; returns 0 if the run did not write one
+int readStats(char* buffer, size_t size) {
+    FILE* file = fopen(statsPath, "r");
+    if (file == NULL) {
+        return 0;
+    }
+    size_t len = fread(buffer, 1, size - 1, file);
+    fclose(file);
+    while (len > 0 && (buffer[len - 1] == '\n' || buffer[len - 1] == '\r')) {
+        len--;
+    }
+    buffer[len] = '\0';
+    return len > 0 && buffer[0] == '{' && buffer[len - 1] == '}';
+}
+
+
+// runs a tool to completion with its output sent to /dev/null and prints the JSON line of the run:
+// wall and CPU time, throughput over the input, the peak resident set size of the tool, and its own --stats report
+void runTool(const char* tool, const char* name, const char* path, char* const argv[], long long rows, long long bytes, int repeat) {
+    remove(statsPath);
+    double start = now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Failed to start %s.\n", path);
+        exit(1);
+    }
+    if (pid == 0) {
+        int devNull = open("/dev/null", O_WRONLY);
+        if (devNull >= 0) {
+            dup2(devNull, STDOUT_FILENO);
+            close(devNull);
+        }
+        execv(path, argv);
+        fprintf(stderr, "Failed to run %s.\n", path);
+        _exit(127);
+    }
+
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        fprintf(stderr, "Failed to wait for %s.\n", path);
+        exit(1);
+    }
+    double wall = now() - start;
+    double user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    double sys = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    int exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    char stats[8192];
+    if (!readStats(stats, sizeof(stats))) {
+        strcpy(stats, "null");
+    }
+
+    fprintf(results, "{\"stage\":\"run\",\"tool\":\"%s\",\"case\":\"%s\",\"repeat\":%d,\"rows\":%lld,\"bytes\":%lld,"
+                     "\"wall_s\":%.6f,\"user_s\":%.6f,\"sys_s\":%.6f,\"rows_per_s\":%.1f,\"mb_per_s\":%.3f,"
+                     "\"peak_rss_kb\":%ld,\"minor_faults\":%ld,\"exit\":%d,\"stats\":%s}\n",
+            tool, name, repeat, rows, bytes, wall, user, sys, wall > 0 ? rows / wall : 0.0,
+            wall > 0 ? bytes / wall / 1e6 : 0.0, usage.ru_maxrss, usage.ru_minflt, exitCode, stats);
+    fflush(results);
+}
+
+
+// benchmarks music_manager on a song CSV of every --rows size: a top-10 pass, a wide top-1000 pass, and a pass
+// with both range filters, each with one and with four ingest threads; two multi-key sorts, one led by a
+// numeric key and one by text keys; then a top-10 pass that writes the snapshot of the CSV (only the first
+// repeat writes it) and the same pass answered from the snapshot
+void benchmarkMusic() {
+    char path[4096], files[4200], snapshot[4200];
+    for (int i = 0; i < numRowCounts; i++) {
+        snprintf(path, sizeof(path), "%s/bench_songs_%lld.csv", dirArg, rowCounts[i]);
+        snprintf(files, sizeof(files), "--files=%s", path);
+        double start = now();
+        long long bytes = generateSongs(path, rowCounts[i], seedArg + i);
+        reportInput("songs", path, rowCounts[i], bytes, now() - start);
+
+        char* cases[][6] = {
+            { "energy_top10", "--sortBy=energy", "--display=10", "--threads=1", NULL, NULL },
+            { "energy_top10_t4", "--sortBy=energy", "--display=10", "--threads=4", NULL, NULL },
+            { "popularity_top1000", "--sortBy=popularity", "--display=1000", "--threads=1", NULL, NULL },
+            { "danceability_filtered", "--sortBy=danceability", "--display=100", "--energy=0.5", "--danceability=0.5", NULL },
+            { "multikey_top10", "--sortBy=energy:desc,year:asc,artist", "--display=10", "--threads=1", NULL, NULL },
+            { "artist_song_top1000_t4", "--sortBy=artist,song:desc", "--display=1000", "--threads=4", NULL, NULL },
+            { "energy_top10_snapshot_build", "--sortBy=energy", "--display=10", "--snapshot", NULL, NULL },
+            { "energy_top10_from_snapshot", "--sortBy=energy", "--display=10", NULL, NULL, NULL },
+        };
+        snprintf(snapshot, sizeof(snapshot), "%s.snap", path);
+        remove(snapshot);
+        for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+            char* argv[10] = { musicArg, files, "--output=/dev/null", statsOption };
+            int n = 4;
+            for (int a = 1; a < 6 && cases[c][a] != NULL; a++) {
+                argv[n++] = cases[c][a];
+            }
+            argv[n] = NULL;
+            for (int r = 0; r < repeatArg; r++) {
+                runTool("music_manager", cases[c][0], musicArg, argv, rowCounts[i], bytes, r);
+            }
+        }
+        if (!keepArg) {
+            remove(path);
+            remove(snapshot);
+        }
+    }
+}
+
+
+// benchmarks event_manager on a calendar of every --ics-events size: a query over all events, a one-week
+// window that most events fall outside of, and the one-week window with four scan threads
+void benchmarkEvents() {
+    char path[4096], file[4200];
+    for (int i = 0; i < numEventCounts; i++) {
+        snprintf(path, sizeof(path), "%s/bench_events_%lld%s.ics", dirArg, eventCounts[i], foldArg ? "_folded" : "");
+        snprintf(file, sizeof(file), "--file=%s", path);
+        double start = now();
+        long long bytes = generateCalendar(path, eventCounts[i], seedArg + 100 + i);
+        reportInput("events", path, eventCounts[i], bytes, now() - start);
+
+        char* cases[][4] = {
+            { "all_events", "--start=2000/01/01", "--end=2024/12/31", NULL },
+            { "one_week", "--start=2012/06/04", "--end=2012/06/10", NULL },
+            { "one_week_t4", "--start=2012/06/04", "--end=2012/06/10", "--threads=4" },
+        };
+        for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+            char* argv[8] = { eventsArg, file, statsOption };
+            int n = 3;
+            for (int a = 1; a < 4 && cases[c][a] != NULL; a++) {
+                argv[n++] = cases[c][a];
+            }
+            argv[n] = NULL;
+            for (int r = 0; r < repeatArg; r++) {
+                runTool("event_manager", cases[c][0], eventsArg, argv, eventCounts[i], bytes, r);
+            }
+        }
+        if (!keepArg) {
+            remove(path);
+        }
+    }
+}
+
+
+// main Function
+int main(int argc, char* argv[]) {
+    extractArguments(argc, argv);
+    if (musicArg == NULL && eventsArg == NULL) {
+        fprintf(stderr, "Nothing to benchmark: give --music=PATH and/or --events=PATH.\n");
+        return 1;
+    }
+    snprintf(statsPath, sizeof(statsPath), "%s/bench_stats.json", dirArg);
+    snprintf(statsOption, sizeof(statsOption), "--stats=%s", statsPath);
+    results = stdout;
+    if (outputArg != NULL && (results = fopen(outputArg, "w")) == NULL) {
+        fprintf(stderr, "Failed to open file %s for writing.\n", outputArg);
+        return 1;
+    }
+    if (musicArg != NULL) {
+        benchmarkMusic();
+    }
+    if (eventsArg != NULL) {
+        benchmarkEvents();
+    }
+    remove(statsPath);
+    if (results != stdout) {
+        fclose(results);
+    }
+    return 0;
+}